@@ -0,0 +1,76 @@
+/**
+ *  @file       avcodecs.cpp
+ *  @brief      Registry of the stream and NAL unit types known to the library
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#include "avcodecs.hpp"
+
+namespace cinekav { namespace codecs {
+
+//  C++11 lacks std::index_sequence, which expands the table indices.
+template<size_t... Is> struct IndexSequence {};
+template<size_t N, size_t... Is>
+struct MakeIndexSequence : MakeIndexSequence<N-1, N-1, Is...> {};
+template<size_t... Is>
+struct MakeIndexSequence<0, Is...> : IndexSequence<Is...> {};
+
+template<typename T, size_t N>
+constexpr size_t countOf(const T (&)[N]) { return N; }
+
+//  constexpr functions are limited to a single return statement in C++11,
+//  so the registries are searched recursively.
+constexpr StreamTypeInfo streamTypeInfo(size_t streamType, size_t index)
+{
+    return index == countOf(kStreamTypes) ?
+                StreamTypeInfo { kFamily_None, kMedia_None, kParser_None, false } :
+           kStreamTypes[index].streamType == streamType ?
+                StreamTypeInfo { kStreamTypes[index].family,
+                                 kStreamTypes[index].media,
+                                 kStreamTypes[index].parser,
+                                 kStreamTypes[index].supported } :
+                streamTypeInfo(streamType, index + 1);
+}
+
+//  the header's type is its low five bits
+constexpr NalInfo nalInfo(size_t nalHeader, size_t index)
+{
+    return index == countOf(kH264NalTypes) ?
+                NalInfo { kNalRole_None, false } :
+           kH264NalTypes[index].nalType == (nalHeader & 0x1f) ?
+                NalInfo { kH264NalTypes[index].role,
+                          kH264NalTypes[index].idr } :
+                nalInfo(nalHeader, index + 1);
+}
+
+template<size_t... Is>
+constexpr StreamTypeTable makeStreamTypeTable(IndexSequence<Is...>)
+{
+    return StreamTypeTable {{ streamTypeInfo(Is, 0)... }};
+}
+
+template<size_t... Is>
+constexpr NalTable makeNalTable(IndexSequence<Is...>)
+{
+    return NalTable {{ nalInfo(Is, 0)... }};
+}
+
+constexpr StreamTypeTable kStreamTypeTable =
+    makeStreamTypeTable(MakeIndexSequence<256>());
+constexpr NalTable kH264NalTable = makeNalTable(MakeIndexSequence<256>());
+
+static_assert(kStreamTypeTable[0x1b].parser == kParser_H264 &&
+              kStreamTypeTable[0x0f].supported &&
+              !kStreamTypeTable[0x24].supported &&
+              !kStreamTypeTable[0x00].supported,
+              "stream type table does not match the registry");
+static_assert(kH264NalTable[0x65].role == kNalRole_VCL &&
+              kH264NalTable[0x65].idr &&
+              kH264NalTable[0x09].role == kNalRole_Leading &&
+              kH264NalTable[0x0c].role == kNalRole_None,
+              "NAL table does not match the registry");
+
+} /* namespace codecs */ } /* namespace cinekav */
@@ -0,0 +1,135 @@
+/**
+ *  @file       avcodecs.hpp
+ *  @brief      Registry of the stream and NAL unit types known to the library
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#ifndef CINEK_AVLIB_CODECS_HPP
+#define CINEK_AVLIB_CODECS_HPP
+
+#include "avdefs.hpp"
+
+namespace cinekav { namespace codecs {
+
+enum Family : uint8_t
+{
+    kFamily_None,
+    kFamily_MPEG1Audio,
+    kFamily_MPEG2Audio,
+    kFamily_AAC,
+    kFamily_AVC,
+    kFamily_HEVC,
+    kFamily_AC3,
+    kFamily_EC3,
+    kFamily_VP9,                // carried in HLS CODECS, not in TS
+    kFamily_AV1
+};
+
+enum Media : uint8_t
+{
+    kMedia_None,
+    kMedia_Audio,
+    kMedia_Video
+};
+
+//  how the payload of an elementary stream is split into access units
+enum Parser : uint8_t
+{
+    kParser_None,               // payload is not split
+    kParser_H264                // split on H.264 access unit boundaries
+};
+
+//  the role of a NAL unit in finding access unit boundaries
+//  (ITU-T H.264 7.4.1.2.3)
+enum NalRole : uint8_t
+{
+    kNalRole_None,              // does not affect boundaries
+    kNalRole_Leading,           // non-VCL, begins an access unit
+    kNalRole_VCL                // slice data
+};
+
+//  Declarative registry entries.  The lookup tables below are generated from
+//  these at compile time.
+struct StreamTypeRegistration
+{
+    uint8_t streamType;         // ISO/IEC 13818-1 Table 2-34
+    Family family;
+    Media media;
+    Parser parser;
+    bool supported;             // demuxed into an elementary stream
+};
+
+struct NalTypeRegistration
+{
+    uint8_t nalType;            // ITU-T H.264 Table 7-1
+    NalRole role;
+    bool idr;
+};
+
+constexpr StreamTypeRegistration kStreamTypes[] =
+{
+    { 0x03, kFamily_MPEG1Audio, kMedia_Audio, kParser_None,  false },
+    { 0x04, kFamily_MPEG2Audio, kMedia_Audio, kParser_None,  false },
+    { 0x0f, kFamily_AAC,        kMedia_Audio, kParser_None,  true  },
+    { 0x1b, kFamily_AVC,        kMedia_Video, kParser_H264,  true  },
+    { 0x24, kFamily_HEVC,       kMedia_Video, kParser_None,  false },
+    { 0x81, kFamily_AC3,        kMedia_Audio, kParser_None,  false },
+    { 0x87, kFamily_EC3,        kMedia_Audio, kParser_None,  false }
+};
+
+constexpr NalTypeRegistration kH264NalTypes[] =
+{
+    { 0x01, kNalRole_VCL,       false },    // non-IDR slice
+    { 0x02, kNalRole_VCL,       false },    // slice data partition A
+    { 0x03, kNalRole_VCL,       false },    // slice data partition B
+    { 0x04, kNalRole_VCL,       false },    // slice data partition C
+    { 0x05, kNalRole_VCL,       true  },    // IDR slice
+    { 0x06, kNalRole_Leading,   false },    // SEI
+    { 0x07, kNalRole_Leading,   false },    // sequence parameter set
+    { 0x08, kNalRole_Leading,   false },    // picture parameter set
+    { 0x09, kNalRole_Leading,   false }     // access unit delimiter
+};
+
+//  Table entries.  Unregistered types are zeroed, which reads as unknown
+//  and unsupported.
+struct StreamTypeInfo
+{
+    Family family;
+    Media media;
+    Parser parser;
+    bool supported;
+};
+
+struct NalInfo
+{
+    NalRole role;
+    bool idr;
+};
+
+//  256 entry tables, indexed by stream_type and by the whole NAL header
+//  byte, so lookups need no masking.
+struct StreamTypeTable
+{
+    StreamTypeInfo entries[256];
+    constexpr const StreamTypeInfo& operator[](uint8_t index) const {
+        return entries[index];
+    }
+};
+
+struct NalTable
+{
+    NalInfo entries[256];
+    constexpr const NalInfo& operator[](uint8_t index) const {
+        return entries[index];
+    }
+};
+
+extern const StreamTypeTable kStreamTypeTable;
+extern const NalTable kH264NalTable;
+
+} /* namespace codecs */ } /* namespace cinekav */
+
+#endif
@@ -0,0 +1,219 @@
+/**
+ *  @file       avcpu.cpp
+ *  @brief      CPU feature detection and dispatch of SIMD kernels
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#include "avcpu.hpp"
+
+#include <cstring>
+
+//  SIMD kernels are compiled with per-function target attributes, so the
+//  library is built for the baseline ISA and one binary runs on any x86 CPU.
+#if CINEK_AVLIB_SIMD && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define CINEK_AVLIB_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define CINEK_AVLIB_X86 0
+#endif
+
+namespace cinekav { namespace cpu {
+
+////////////////////////////////////////////////////////////////////////////////
+//  Scalar kernels
+
+static size_t findStartCodeScalar(const uint8_t* data, size_t from, size_t len)
+{
+    size_t i = from;
+    while (i < len)
+    {
+        //  a byte above 1 can't be within a start code ending at i, i+1 or
+        //  i+2, so the scan advances by three
+        if (data[i] > 1)
+        {
+            i += 3;
+        }
+        else if (data[i] == 1 && !data[i-1] && !data[i-2])
+        {
+            return i;
+        }
+        else
+        {
+            ++i;
+        }
+    }
+    return len;
+}
+
+#if CINEK_AVLIB_X86
+////////////////////////////////////////////////////////////////////////////////
+//  x86 kernels
+//
+//  Start codes are found by comparing three overlapping loads, offset by one
+//  byte, against 00, 00 and 01.  The scalar kernel handles the remainder.
+//
+//  Most scans are over a single packet's payload, so the wider kernels
+//  leave inputs shorter than two of their vectors to the next narrower
+//  kernel.  The upper register state is cleared before handing off, as
+//  SSE2 code following dirty AVX state pays a transition penalty per call.
+
+__attribute__((target("sse2")))
+static size_t findStartCodeSSE2(const uint8_t* data, size_t from, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    size_t i = from;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i - 2));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i - 1));
+        __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i m = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero),
+                                                _mm_cmpeq_epi8(b1, zero)),
+                                  _mm_cmpeq_epi8(b2, one));
+        int mask = _mm_movemask_epi8(m);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return findStartCodeScalar(data, i, len);
+}
+
+__attribute__((target("avx2")))
+static size_t findStartCodeAVX2(const uint8_t* data, size_t from, size_t len)
+{
+    if (from + 64 > len)
+        return findStartCodeSSE2(data, from, len);
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    size_t i = from;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i - 2));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i - 1));
+        __m256i b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i m = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+                                                      _mm256_cmpeq_epi8(b1, zero)),
+                                     _mm256_cmpeq_epi8(b2, one));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return findStartCodeSSE2(data, i, len);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t findStartCodeAVX512(const uint8_t* data, size_t from, size_t len)
+{
+    if (from + 128 > len)
+        return findStartCodeAVX2(data, from, len);
+
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi8(1);
+    size_t i = from;
+    for (; i + 64 <= len; i += 64)
+    {
+        __m512i b0 = _mm512_loadu_si512(data + i - 2);
+        __m512i b1 = _mm512_loadu_si512(data + i - 1);
+        __m512i b2 = _mm512_loadu_si512(data + i);
+        uint64_t mask = _mm512_cmpeq_epi8_mask(b0, zero) &
+                        _mm512_cmpeq_epi8_mask(b1, zero) &
+                        _mm512_cmpeq_epi8_mask(b2, one);
+        if (mask)
+            return i + __builtin_ctzll(mask);
+    }
+    _mm256_zeroupper();
+    return findStartCodeAVX2(data, i, len);
+}
+
+static uint32_t detectFeatures()
+{
+    uint32_t features = 0;
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return features;
+
+    if (edx & bit_SSE2)
+        features |= kSSE2;
+    if (ecx & bit_SSE4_2)
+        features |= kSSE42;
+
+    //  wider registers also need the OS to save their state
+    if (!(ecx & bit_OSXSAVE))
+        return features;
+    uint32_t xcrLo, xcrHi;
+    __asm__ ("xgetbv" : "=a"(xcrLo), "=d"(xcrHi) : "c"(0));
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return features;
+
+    if ((xcrLo & 0x06) == 0x06 && (ebx & bit_AVX2))
+        features |= kAVX2;
+    if ((xcrLo & 0xe6) == 0xe6 && (ebx & bit_AVX512F) && (ebx & bit_AVX512BW))
+        features |= kAVX512;
+    return features;
+}
+
+#else
+
+static uint32_t detectFeatures()
+{
+    return 0;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+Kernels gKernels =
+{
+    &findStartCodeScalar
+};
+
+static uint32_t gBoundFeatures = 0;
+
+uint32_t detectedFeatures()
+{
+    static const uint32_t features = detectFeatures();
+    return features;
+}
+
+uint32_t boundFeatures()
+{
+    return gBoundFeatures;
+}
+
+void bindKernels(uint32_t featureMask)
+{
+    uint32_t features = detectedFeatures() & featureMask;
+
+    Kernels kernels =
+    {
+        &findStartCodeScalar
+    };
+
+#if CINEK_AVLIB_X86
+    if (features & kSSE2)
+    {
+        kernels.findStartCode = &findStartCodeSSE2;
+    }
+    if (features & kAVX2)
+    {
+        kernels.findStartCode = &findStartCodeAVX2;
+    }
+    if (features & kAVX512)
+    {
+        kernels.findStartCode = &findStartCodeAVX512;
+    }
+#endif
+
+    gKernels = kernels;
+    gBoundFeatures = features;
+}
+
+} /* namespace cpu */ } /* namespace cinekav */
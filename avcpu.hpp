@@ -0,0 +1,53 @@
+/**
+ *  @file       avcpu.hpp
+ *  @brief      CPU feature detection and dispatch of SIMD kernels
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#ifndef CINEK_AVLIB_CPU_HPP
+#define CINEK_AVLIB_CPU_HPP
+
+#include "avdefs.hpp"
+
+namespace cinekav {
+namespace cpu {
+
+enum Feature
+{
+    kSSE2               = 0x01,
+    kSSE42              = 0x02,
+    kAVX2               = 0x04,
+    kAVX512             = 0x08      // AVX-512 F and BW
+};
+
+//  Kernels with a scalar implementation and optional SIMD variants.  The
+//  table holds the scalar kernels until bindKernels is called.
+struct Kernels
+{
+    //  returns the index of the 0x01 ending the first 00 00 01 start code
+    //  found at or after index from, or len if there is none.  from must be
+    //  at least 2.
+    size_t (*findStartCode)(const uint8_t* data, size_t from, size_t len);
+};
+
+//  Detects the CPU's features once, and binds the best kernels available
+//  within featureMask.  cinekav::initialize binds with all features.  A
+//  mask of 0 forces the scalar kernels, i.e. for testing.
+void bindKernels(uint32_t featureMask=~0u);
+
+//  features supported by the CPU and OS
+uint32_t detectedFeatures();
+//  detected features permitted by the last bindKernels call
+uint32_t boundFeatures();
+
+extern Kernels gKernels;
+
+inline const Kernels& kernels() { return gKernels; }
+
+}   /* namespace cpu */
+}   /* namespace cinekav */
+
+#endif
@@ -15,5 +15,6 @@
 
 #define CINEK_AVLIB_IOSTREAMS   1
 #define CINEK_AVLIB_EXCEPTIONS  0
+#define CINEK_AVLIB_SIMD        1
 
 #endif
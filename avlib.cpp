@@ -8,8 +8,15 @@
  */
 
 #include "avlib.hpp"
+#include "avcpu.hpp"
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 namespace cinekav {
 
@@ -23,25 +30,256 @@ static void DefaultFree(void*, int, void* ptr)
     free(ptr);
 }
 
+static const size_t kPageSize = 4096;
+static const size_t kHugePageSize = 2*1024*1024;
+
+static size_t hintedAlignment(const AllocHints& hints)
+{
+    return hints.alignment > sizeof(void*) ? hints.alignment : sizeof(void*);
+}
+
+//  one write per page commits it now rather than mid-playback
+static void prefaultPages(void* ptr, size_t sz)
+{
+    volatile uint8_t* bytes = reinterpret_cast<volatile uint8_t*>(ptr);
+    for (size_t offset = 0; offset < sz; offset += kPageSize)
+    {
+        bytes[offset] = 0;
+    }
+}
+
+#if defined(__linux__)
+//  allocations smaller than a huge page gain nothing from one
+static bool isHugeMapping(size_t sz, const AllocHints& hints)
+{
+    return (hints.flags & AllocHints::kHugePages) && sz >= kHugePageSize;
+}
+
+static size_t hugeMappingSize(size_t sz)
+{
+    return (sz + kHugePageSize - 1) & ~(kHugePageSize - 1);
+}
+#endif
+
+static void* DefaultMallocHinted(void*, int, size_t sz, const AllocHints& hints)
+{
+    void* ptr = nullptr;
+#if defined(__linux__)
+    if (isHugeMapping(sz, hints))
+    {
+        //  transparent huge pages require a 2 MiB aligned range, so map an
+        //  extra huge page and trim the mapping to the aligned span.
+        size_t len = hugeMappingSize(sz);
+        void* mapped = mmap(nullptr, len + kHugePageSize, PROT_READ|PROT_WRITE,
+                            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+            return nullptr;
+        uint8_t* start = reinterpret_cast<uint8_t*>(mapped);
+        uint8_t* aligned = reinterpret_cast<uint8_t*>(
+            (reinterpret_cast<uintptr_t>(start) + kHugePageSize - 1) &
+                ~(uintptr_t)(kHugePageSize - 1));
+        if (aligned > start)
+            munmap(start, aligned - start);
+        uint8_t* end = start + len + kHugePageSize;
+        if (end > aligned + len)
+            munmap(aligned + len, end - (aligned + len));
+        madvise(aligned, len, MADV_HUGEPAGE);
+        ptr = aligned;
+    }
+    else
+#endif
+    if (posix_memalign(&ptr, hintedAlignment(hints), sz))
+    {
+        return nullptr;
+    }
+    if (hints.flags & AllocHints::kPrefault)
+    {
+        prefaultPages(ptr, sz);
+    }
+    return ptr;
+}
+
+static void DefaultFreeHinted(void*, int, void* ptr, size_t sz,
+                              const AllocHints& hints)
+{
+#if defined(__linux__)
+    if (isHugeMapping(sz, hints))
+    {
+        munmap(ptr, hugeMappingSize(sz));
+        return;
+    }
+#endif
+    free(ptr);
+}
+
 static AllocFn gAllocFn = &DefaultMalloc;
 static FreeFn gFreeFn = &DefaultFree;
+static AllocHintedFn gAllocHintedFn = &DefaultMallocHinted;
+static FreeHintedFn gFreeHintedFn = &DefaultFreeHinted;
 static void* gMemoryContext = nullptr;
 
+//  Hinted allocations for applications supplying only AllocFn.  Blocks are
+//  over-allocated to honor alignment, with the block start stored just
+//  before the aligned pointer.  Huge pages are left to the application.
+static void* RegionAllocHinted(void* context, int region, size_t sz,
+                               const AllocHints& hints)
+{
+    size_t alignment = hintedAlignment(hints);
+    uint8_t* block = reinterpret_cast<uint8_t*>(
+        gAllocFn(context, region, sz + alignment + sizeof(void*)));
+    if (!block)
+        return nullptr;
+    uint8_t* aligned = reinterpret_cast<uint8_t*>(
+        (reinterpret_cast<uintptr_t>(block) + sizeof(void*) + alignment - 1) &
+            ~(uintptr_t)(alignment - 1));
+    memcpy(aligned - sizeof(void*), &block, sizeof(void*));
+    if (hints.flags & AllocHints::kPrefault)
+    {
+        prefaultPages(aligned, sz);
+    }
+    return aligned;
+}
+
+static void RegionFreeHinted(void* context, int region, void* ptr, size_t,
+                             const AllocHints&)
+{
+    void* block;
+    memcpy(&block, reinterpret_cast<uint8_t*>(ptr) - sizeof(void*),
+           sizeof(void*));
+    gFreeFn(context, region, block);
+}
+
+struct RegionCounters
+{
+    std::atomic<uint64_t> liveBytes;
+    std::atomic<uint64_t> peakBytes;
+    std::atomic<uint64_t> allocCount;
+    std::atomic<uint64_t> freeCount;
+};
+
+static RegionCounters gRegionCounters[kMemoryStatsRegionCount];
+
+static RegionCounters& regionCounters(int region)
+{
+    if (region < 0 || region >= kMemoryStatsRegionCount)
+        region = kMemoryStatsRegionCount-1;
+    return gRegionCounters[region];
+}
+
+static void countAllocation(int region, size_t sz)
+{
+    RegionCounters& counters = regionCounters(region);
+    counters.allocCount.fetch_add(1, std::memory_order_relaxed);
+    uint64_t live = counters.liveBytes.fetch_add(sz, std::memory_order_relaxed) + sz;
+    uint64_t peak = counters.peakBytes.load(std::memory_order_relaxed);
+    while (live > peak &&
+           !counters.peakBytes.compare_exchange_weak(peak, live,
+                                                     std::memory_order_relaxed))
+    {
+    }
+}
+
+static void countFree(int region, size_t sz)
+{
+    RegionCounters& counters = regionCounters(region);
+    counters.freeCount.fetch_add(1, std::memory_order_relaxed);
+    if (sz)
+        counters.liveBytes.fetch_sub(sz, std::memory_order_relaxed);
+}
+
+MemoryStats memoryStats(int region)
+{
+    const RegionCounters& counters = regionCounters(region);
+    MemoryStats stats;
+    stats.liveBytes = counters.liveBytes.load(std::memory_order_relaxed);
+    stats.peakBytes = counters.peakBytes.load(std::memory_order_relaxed);
+    stats.allocCount = counters.allocCount.load(std::memory_order_relaxed);
+    stats.freeCount = counters.freeCount.load(std::memory_order_relaxed);
+    return stats;
+}
+
+int snapshotMemoryStats(MemoryStats* stats, int count)
+{
+    if (count > kMemoryStatsRegionCount)
+        count = kMemoryStatsRegionCount;
+    for (int region = 0; region < count; ++region)
+    {
+        stats[region] = memoryStats(region);
+    }
+    return count;
+}
+
+void resetMemoryPeaks()
+{
+    for (auto& counters : gRegionCounters)
+    {
+        counters.peakBytes.store(counters.liveBytes.load(std::memory_order_relaxed),
+                                 std::memory_order_relaxed);
+    }
+}
+
 void* Memory::allocate(size_t sz)
 {
-    return gAllocFn(gMemoryContext, _region, sz);
+    void* ptr = gAllocFn(gMemoryContext, _region, sz);
+    if (ptr)
+        countAllocation(_region, sz);
+    return ptr;
 }
 
 void Memory::free(void* ptr)
 {
+    if (ptr)
+        countFree(_region, 0);
     gFreeFn(gMemoryContext, _region, ptr);
 }
 
+void Memory::free(void* ptr, size_t sz)
+{
+    if (ptr)
+        countFree(_region, sz);
+    gFreeFn(gMemoryContext, _region, ptr);
+}
+
+void* Memory::allocate(size_t sz, const AllocHints& hints)
+{
+    if (hints.empty())
+        return allocate(sz);
+    void* ptr = gAllocHintedFn(gMemoryContext, _region, sz, hints);
+    if (ptr)
+        countAllocation(_region, sz);
+    return ptr;
+}
+
+void Memory::free(void* ptr, size_t sz, const AllocHints& hints)
+{
+    if (hints.empty())
+    {
+        free(ptr, sz);
+    }
+    else if (ptr)
+    {
+        countFree(_region, sz);
+        gFreeHintedFn(gMemoryContext, _region, ptr, sz, hints);
+    }
+}
+
 void initialize(AllocFn allocFn, FreeFn freeFn, void* context)
+{
+    initialize(allocFn, freeFn, &RegionAllocHinted, &RegionFreeHinted,
+               context);
+}
+
+void initialize(AllocFn allocFn, FreeFn freeFn,
+                AllocHintedFn allocHintedFn, FreeHintedFn freeHintedFn,
+                void* context)
 {
     gAllocFn = allocFn;
     gFreeFn = freeFn;
+    gAllocHintedFn = allocHintedFn;
+    gFreeHintedFn = freeHintedFn;
     gMemoryContext = context;
+
+    cpu::bindKernels();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -58,7 +296,13 @@ Buffer::Buffer(const Memory& memory) :
 }
 
 Buffer::Buffer(int sz, const Memory& memory) :
+    Buffer(sz, AllocHints(), memory)
+{
+}
+
+Buffer::Buffer(int sz, const AllocHints& hints, const Memory& memory) :
     _memory(memory),
+    _hints(hints),
     _buffer(nullptr),
     _head(nullptr),
     _tail(nullptr),
@@ -68,7 +312,7 @@ Buffer::Buffer(int sz, const Memory& memory) :
 {
     if (_owned)
     {
-        _buffer = reinterpret_cast<uint8_t*>(_memory.allocate(sz));
+        _buffer = reinterpret_cast<uint8_t*>(_memory.allocate(sz, _hints));
         if (_buffer)
         {
             _limit = _buffer + sz;
@@ -102,12 +346,14 @@ Buffer::~Buffer()
 {
     if (_owned)
     {
-        _memory.free(_buffer);
+        _memory.free(_buffer, capacity(), _hints);
         _buffer = nullptr;
     }
 }
 
 Buffer::Buffer(Buffer&& other) :
+    _memory(other._memory),
+    _hints(other._hints),
     _buffer(other._buffer),
     _head(other._head),
     _tail(other._tail),
@@ -127,8 +373,10 @@ Buffer& Buffer::operator=(Buffer&& other)
 {
     if (_owned && _buffer)
     {
-        _memory.free(_buffer);
+        _memory.free(_buffer, capacity(), _hints);
     }
+    _memory = other._memory;
+    _hints = other._hints;
     _buffer = other._buffer;
     _head = other._head;
     _tail = other._tail;
@@ -224,6 +472,116 @@ Buffer Buffer::createSubBufferFromUsed()
     return Buffer(_head, _tail - _head);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+BlockPool::BlockPool(const Memory& memory) :
+    _memory(memory),
+    _blocks(nullptr),
+    _blockCount(0),
+    _blockSize(0)
+{
+}
+
+BlockPool::~BlockPool()
+{
+    freeBlocks();
+}
+
+bool BlockPool::reset(uint8_t* region, size_t size, int blockCount)
+{
+    if (freeCount() != _blockCount)
+        return false;
+
+    freeBlocks();
+    if (!region || blockCount <= 0)
+        return true;
+
+    _blocks = reinterpret_cast<Block*>(
+        _memory.allocate(sizeof(Block) * blockCount));
+    if (!_blocks)
+        return false;
+
+    _blockCount = blockCount;
+    _blockSize = size / blockCount;
+    for (int i = 0; i < _blockCount; ++i)
+    {
+        Block* block = ::new(&_blocks[i]) Block;
+        block->data = region + i * _blockSize;
+        block->refs.store(0, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void BlockPool::freeBlocks()
+{
+    if (_blocks)
+    {
+        for (int i = 0; i < _blockCount; ++i)
+        {
+            _blocks[i].~Block();
+        }
+        _memory.free(_blocks, sizeof(Block) * _blockCount);
+    }
+    _blocks = nullptr;
+    _blockCount = 0;
+    _blockSize = 0;
+}
+
+//  A block is free while its count is zero.  Claiming it with a compare and
+//  swap keeps acquire safe against releases from consumer threads without a
+//  separate free list.
+BlockPool::Block* BlockPool::acquire()
+{
+    for (int i = 0; i < _blockCount; ++i)
+    {
+        uint32_t expected = 0;
+        if (_blocks[i].refs.compare_exchange_strong(expected, 1,
+                                                    std::memory_order_acquire,
+                                                    std::memory_order_relaxed))
+        {
+            return &_blocks[i];
+        }
+    }
+    return nullptr;
+}
+
+void BlockPool::addRef(Block* block)
+{
+    block->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BlockPool::release(Block* block)
+{
+    block->refs.fetch_sub(1, std::memory_order_release);
+}
+
+uint32_t BlockPool::refCount(const Block* block)
+{
+    return block->refs.load(std::memory_order_acquire);
+}
+
+int BlockPool::freeCount() const
+{
+    int cnt = 0;
+    for (int i = 0; i < _blockCount; ++i)
+    {
+        if (!_blocks[i].refs.load(std::memory_order_acquire))
+            ++cnt;
+    }
+    return cnt;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void copySlices(uint8_t* dst, const BufferSlice* slices, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        memcpy(dst, slices[i].data, slices[i].size);
+        dst += slices[i].size;
+    }
+}
+
 StringBuffer::StringBuffer()
 {
 }
@@ -239,19 +597,53 @@ StringBuffer::StringBuffer(Buffer&& buffer) :
 }
 
 
+//  Locates the next line in the buffer and consumes it, including its
+//  delimiter.  memchr is used for the scan since the C library provides a
+//  vectorized implementation on all of our targets.  When splitting on '\n',
+//  a trailing '\r' is excluded from the line so CRLF input is handled in the
+//  same pass.
+const uint8_t* StringBuffer::nextLine(const uint8_t** lineEnd, char delim)
+{
+    uint8_t* head = _buffer._head;
+    uint8_t* tail = _buffer._tail;
+    uint8_t* pos = nullptr;
+    if (head != tail)
+    {
+        pos = reinterpret_cast<uint8_t*>(memchr(head, delim, tail - head));
+    }
+    if (pos)
+    {
+        _buffer._head = pos+1;
+    }
+    else
+    {
+        pos = tail;
+        _buffer._head = tail;
+    }
+    if (delim == '\n' && pos != head && *(pos-1) == '\r')
+    {
+        --pos;
+    }
+    *lineEnd = pos;
+    return head;
+}
+
 //  skips null characters if delim != 0.
 //  else terminates on delim or end of buffer.
 StringBuffer& StringBuffer::getline(std::string& str, char delim)
 {
-    str.clear();
-    while (!_buffer.empty())
-    {
-        char ch = (char)_buffer.pullByte();
-        if (ch == delim)
-            break;
-        str.push_back(ch);
-    }
+    const uint8_t* lineEnd;
+    const uint8_t* line = nextLine(&lineEnd, delim);
+    str.assign(reinterpret_cast<const char*>(line), lineEnd - line);
+    return *this;
+}
 
+StringBuffer& StringBuffer::getline(const char** str, size_t* len, char delim)
+{
+    const uint8_t* lineEnd;
+    const uint8_t* line = nextLine(&lineEnd, delim);
+    *str = reinterpret_cast<const char*>(line);
+    *len = lineEnd - line;
     return *this;
 }
 
@@ -261,5 +653,541 @@ bool StringBuffer::end() const
 }
 
 
+static const uint64_t kHashPrime1 = 0x9E3779B185EBCA87ull;
+static const uint64_t kHashPrime2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t kHashPrime3 = 0x165667B19E3779F9ull;
+static const uint64_t kHashPrime4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t kHashPrime5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t hashRotl(uint64_t v, int r)
+{
+    return (v << r) | (v >> (64 - r));
+}
+
+//  unaligned little-endian loads
+static inline uint64_t hashRead64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hashRead32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hashRound(uint64_t acc, uint64_t input)
+{
+    acc += input * kHashPrime2;
+    acc = hashRotl(acc, 31);
+    return acc * kHashPrime1;
+}
+
+static inline uint64_t hashMerge(uint64_t h, uint64_t acc)
+{
+    h ^= hashRound(0, acc);
+    return h * kHashPrime1 + kHashPrime4;
+}
+
+Hash64::Hash64(uint64_t seed)
+{
+    reset(seed);
+}
+
+void Hash64::reset(uint64_t seed)
+{
+    _acc[0] = seed + kHashPrime1 + kHashPrime2;
+    _acc[1] = seed + kHashPrime2;
+    _acc[2] = seed;
+    _acc[3] = seed - kHashPrime1;
+    _seed = seed;
+    _total = 0;
+    _pendingLen = 0;
+}
+
+void Hash64::update(const void* data, size_t len)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    const uint8_t* end = p + len;
+    _total += len;
+
+    if (_pendingLen + len < sizeof(_pending))
+    {
+        if (len)
+            memcpy(_pending + _pendingLen, p, len);
+        _pendingLen += (uint32_t)len;
+        return;
+    }
+    if (_pendingLen)
+    {
+        size_t fill = sizeof(_pending) - _pendingLen;
+        memcpy(_pending + _pendingLen, p, fill);
+        p += fill;
+        for (int i = 0; i < 4; ++i)
+            _acc[i] = hashRound(_acc[i], hashRead64(_pending + i*8));
+        _pendingLen = 0;
+    }
+    //  32-byte stripes, one lane per accumulator
+    while (end - p >= 32)
+    {
+        _acc[0] = hashRound(_acc[0], hashRead64(p));
+        _acc[1] = hashRound(_acc[1], hashRead64(p+8));
+        _acc[2] = hashRound(_acc[2], hashRead64(p+16));
+        _acc[3] = hashRound(_acc[3], hashRead64(p+24));
+        p += 32;
+    }
+    if (p != end)
+    {
+        memcpy(_pending, p, end - p);
+        _pendingLen = (uint32_t)(end - p);
+    }
+}
+
+uint64_t Hash64::digest() const
+{
+    uint64_t h;
+    if (_total >= 32)
+    {
+        h = hashRotl(_acc[0], 1) + hashRotl(_acc[1], 7) +
+            hashRotl(_acc[2], 12) + hashRotl(_acc[3], 18);
+        for (int i = 0; i < 4; ++i)
+            h = hashMerge(h, _acc[i]);
+    }
+    else
+    {
+        h = _seed + kHashPrime5;
+    }
+    h += _total;
+
+    const uint8_t* p = _pending;
+    const uint8_t* end = _pending + _pendingLen;
+    while (end - p >= 8)
+    {
+        h ^= hashRound(0, hashRead64(p));
+        h = hashRotl(h, 27) * kHashPrime1 + kHashPrime4;
+        p += 8;
+    }
+    if (end - p >= 4)
+    {
+        h ^= (uint64_t)hashRead32(p) * kHashPrime1;
+        h = hashRotl(h, 23) * kHashPrime2 + kHashPrime3;
+        p += 4;
+    }
+    while (p != end)
+    {
+        h ^= (*p) * kHashPrime5;
+        h = hashRotl(h, 11) * kHashPrime1;
+        ++p;
+    }
+    h ^= h >> 33;
+    h *= kHashPrime2;
+    h ^= h >> 29;
+    h *= kHashPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t Hash64::compute(const void* data, size_t len, uint64_t seed)
+{
+    Hash64 hash(seed);
+    hash.update(data, len);
+    return hash.digest();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BufferChain::BufferChain(const Memory& memory) :
+    _slices(memory),
+    _starts(memory),
+    _size(0)
+{
+}
+
+bool BufferChain::append(const uint8_t* data, size_t len)
+{
+    if (!len)
+        return true;
+    if (!_slices.empty())
+    {
+        BufferSlice& last = _slices.back();
+        if (last.data + last.size == data)
+        {
+            last.size += len;
+            _size += len;
+            return true;
+        }
+    }
+    BufferSlice slice = { data, len };
+    _slices.push_back(slice);
+    _starts.push_back(_size);
+    _size += len;
+    return true;
+}
+
+void BufferChain::clear()
+{
+    _slices.clear();
+    _starts.clear();
+    _size = 0;
+}
+
+size_t BufferChain::memoryUsage() const
+{
+    return _slices.capacity() * sizeof(BufferSlice) +
+           _starts.capacity() * sizeof(size_t);
+}
+
+size_t BufferChain::findSlice(size_t offset) const
+{
+    auto it = std::upper_bound(_starts.begin(), _starts.end(), offset);
+    return (it - _starts.begin()) - 1;
+}
+
+size_t BufferChain::copyOut(size_t offset, uint8_t* dst, size_t len) const
+{
+    if (offset >= _size)
+        return 0;
+    if (len > _size - offset)
+        len = _size - offset;
+
+    size_t index = findSlice(offset);
+    size_t sliceOffset = offset - _starts[index];
+    size_t copied = 0;
+    while (copied < len)
+    {
+        const BufferSlice& slice = _slices[index++];
+        size_t cnt = slice.size - sliceOffset;
+        if (cnt > len - copied)
+            cnt = len - copied;
+        memcpy(dst + copied, slice.data + sliceOffset, cnt);
+        copied += cnt;
+        sliceOffset = 0;
+    }
+    return copied;
+}
+
+size_t BufferChain::gather(size_t offset, size_t len, BufferSlice* out,
+                           size_t maxSlices) const
+{
+    if (offset >= _size || !len)
+        return 0;
+    if (len > _size - offset)
+        len = _size - offset;
+
+    size_t index = findSlice(offset);
+    size_t sliceOffset = offset - _starts[index];
+    size_t count = 0;
+    while (len)
+    {
+        const BufferSlice& slice = _slices[index++];
+        size_t cnt = slice.size - sliceOffset;
+        if (cnt > len)
+            cnt = len;
+        if (count < maxSlices)
+        {
+            out[count].data = slice.data + sliceOffset;
+            out[count].size = cnt;
+        }
+        ++count;
+        len -= cnt;
+        sliceOffset = 0;
+    }
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BitReader::BitReader(const uint8_t* data, size_t len) :
+    _head(data),
+    _tail(data + len),
+    _cache(0),
+    _cacheBits(0),
+    _overflow(false)
+{
+}
+
+void BitReader::refill()
+{
+    if (_tail - _head >= 8)
+    {
+        //  load a whole word and keep the bytes that fit.  bits below
+        //  _cacheBits may hold the start of the next byte, which is reloaded
+        //  into the same position on the next refill.
+        int bytes = (64 - _cacheBits) >> 3;
+        _cache |= loadBE64(_head) >> _cacheBits;
+        _head += bytes;
+        _cacheBits += bytes * 8;
+    }
+    else
+    {
+        while (_cacheBits <= 56 && _head != _tail)
+        {
+            _cache |= (uint64_t)*(_head++) << (56 - _cacheBits);
+            _cacheBits += 8;
+        }
+    }
+}
+
+uint32_t BitReader::read(int bits)
+{
+    if (!bits)
+        return 0;
+    if (_cacheBits < bits)
+    {
+        refill();
+        if (_cacheBits < bits)
+        {
+            //  the cache is zero past the last byte
+            _overflow = true;
+            uint32_t v = (uint32_t)(_cache >> (64 - bits));
+            _cache = 0;
+            _cacheBits = 0;
+            return v;
+        }
+    }
+    uint32_t v = (uint32_t)(_cache >> (64 - bits));
+    _cache <<= bits;
+    _cacheBits -= bits;
+    return v;
+}
+
+void BitReader::skip(int bits)
+{
+    while (bits > 32)
+    {
+        read(32);
+        bits -= 32;
+    }
+    read(bits);
+}
+
+uint32_t BitReader::readUE()
+{
+    int zeros = 0;
+    while (!read(1))
+    {
+        if (_overflow || ++zeros > 31)
+        {
+            _overflow = true;
+            return 0;
+        }
+    }
+    return ((1u << zeros) - 1) + read(zeros);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//  uri components as views into the source string.  undefined components
+//  have a null pointer, which differs from an empty component.
+struct UrlParts
+{
+    const char* scheme = nullptr;
+    size_t schemeLen = 0;
+    const char* authority = nullptr;
+    size_t authorityLen = 0;
+    const char* path = nullptr;
+    size_t pathLen = 0;
+    const char* query = nullptr;
+    size_t queryLen = 0;
+    const char* fragment = nullptr;
+    size_t fragmentLen = 0;
+};
+
+static bool isSchemeChar(char ch, bool first)
+{
+    if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'))
+        return true;
+    if (first)
+        return false;
+    return (ch >= '0' && ch <= '9') || ch == '+' || ch == '-' || ch == '.';
+}
+
+static void splitUrl(const char* str, size_t len, UrlParts& parts)
+{
+    const char* p = str;
+    const char* end = str + len;
+
+    const char* s = p;
+    while (s != end && isSchemeChar(*s, s == p))
+        ++s;
+    if (s != p && s != end && *s == ':')
+    {
+        parts.scheme = p;
+        parts.schemeLen = s - p;
+        p = s + 1;
+    }
+    if (end - p >= 2 && p[0] == '/' && p[1] == '/')
+    {
+        p += 2;
+        s = p;
+        while (s != end && *s != '/' && *s != '?' && *s != '#')
+            ++s;
+        parts.authority = p;
+        parts.authorityLen = s - p;
+        p = s;
+    }
+    s = p;
+    while (s != end && *s != '?' && *s != '#')
+        ++s;
+    parts.path = p;
+    parts.pathLen = s - p;
+    p = s;
+    if (p != end && *p == '?')
+    {
+        s = ++p;
+        while (s != end && *s != '#')
+            ++s;
+        parts.query = p;
+        parts.queryLen = s - p;
+        p = s;
+    }
+    if (p != end && *p == '#')
+    {
+        ++p;
+        parts.fragment = p;
+        parts.fragmentLen = end - p;
+    }
+}
+
+//  removes the last segment and its preceding '/' from buf[start, w),
+//  returning the new write position.
+static size_t popPathSegment(const char* buf, size_t start, size_t w)
+{
+    while (w > start && buf[w-1] != '/')
+        --w;
+    return w > start ? w-1 : start;
+}
+
+//  RFC 3986 5.2.4, applied in place to str[start, end).  the output never
+//  outgrows the consumed input, so the write position trails the read
+//  position within the same string.
+static void removeDotSegments(std::string& str, size_t start)
+{
+    char* buf = &str[0];
+    size_t r = start;
+    size_t w = start;
+    size_t end = str.size();
+    while (r < end)
+    {
+        const char* p = buf + r;
+        size_t n = end - r;
+        if (n >= 3 && !memcmp(p, "../", 3))
+            r += 3;
+        else if (n >= 2 && !memcmp(p, "./", 2))
+            r += 2;
+        else if (n >= 3 && !memcmp(p, "/./", 3))
+            r += 2;
+        else if (n == 2 && !memcmp(p, "/.", 2))
+        {
+            buf[w++] = '/';
+            r = end;
+        }
+        else if (n >= 4 && !memcmp(p, "/../", 4))
+        {
+            r += 3;
+            w = popPathSegment(buf, start, w);
+        }
+        else if (n == 3 && !memcmp(p, "/..", 3))
+        {
+            w = popPathSegment(buf, start, w);
+            buf[w++] = '/';
+            r = end;
+        }
+        else if ((n == 1 && p[0] == '.') ||
+                 (n == 2 && p[0] == '.' && p[1] == '.'))
+        {
+            r = end;
+        }
+        else
+        {
+            //  move the first path segment, including any initial '/'
+            size_t seg = r;
+            if (buf[r] == '/')
+                ++r;
+            while (r < end && buf[r] != '/')
+                ++r;
+            memmove(buf + w, buf + seg, r - seg);
+            w += r - seg;
+        }
+    }
+    str.resize(w);
+}
+
+void resolveUrl(std::string& out, const char* base, size_t baseLen,
+                const char* ref, size_t refLen)
+{
+    UrlParts r;
+    splitUrl(ref, refLen, r);
+    if (!r.scheme && !baseLen)
+    {
+        out.assign(ref, refLen);
+        return;
+    }
+    UrlParts b;
+    splitUrl(base, baseLen, b);
+
+    const UrlParts& schemeSrc = r.scheme ? r : b;
+    const UrlParts& authoritySrc = (r.scheme || r.authority) ? r : b;
+
+    out.clear();
+    if (schemeSrc.scheme)
+    {
+        out.append(schemeSrc.scheme, schemeSrc.schemeLen);
+        out += ':';
+    }
+    if (authoritySrc.authority)
+    {
+        out += "//";
+        out.append(authoritySrc.authority, authoritySrc.authorityLen);
+    }
+
+    const char* query = r.query;
+    size_t queryLen = r.queryLen;
+    size_t pathStart = out.size();
+    if (r.scheme || r.authority || (r.pathLen && r.path[0] == '/'))
+    {
+        out.append(r.path, r.pathLen);
+        removeDotSegments(out, pathStart);
+    }
+    else if (!r.pathLen)
+    {
+        out.append(b.path, b.pathLen);
+        if (!query)
+        {
+            query = b.query;
+            queryLen = b.queryLen;
+        }
+    }
+    else
+    {
+        //  merge with the base path up to and including its last '/'
+        if (b.authority && !b.pathLen)
+        {
+            out += '/';
+        }
+        else
+        {
+            size_t dirLen = b.pathLen;
+            while (dirLen && b.path[dirLen-1] != '/')
+                --dirLen;
+            out.append(b.path, dirLen);
+        }
+        out.append(r.path, r.pathLen);
+        removeDotSegments(out, pathStart);
+    }
+    if (query)
+    {
+        out += '?';
+        out.append(query, queryLen);
+    }
+    if (r.fragment)
+    {
+        out += '#';
+        out.append(r.fragment, r.fragmentLen);
+    }
+}
 
-} /* namespace ckavlib */
\ No newline at end of file
+} /* namespace ckavlib */
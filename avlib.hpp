@@ -12,6 +12,11 @@
 
 #include "avdefs.hpp"
 
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <vector>
+
 #if CINEK_AVLIB_IOSTREAMS
 #include <streambuf>
 #include <istream>
@@ -25,7 +30,62 @@ namespace cinekav {
 typedef void* (*AllocFn)(void* context, int region, size_t sz);
 typedef void (*FreeFn)(void* context, int region, void* ptr);
 
+//  Placement hints for large or performance critical allocations.  Hints
+//  are advisory; an allocator may ignore any it cannot honor.
+struct AllocHints
+{
+    enum
+    {
+        kHugePages      = 0x01,     // back with 2 MiB pages when available
+        kPrefault       = 0x02      // fault in pages at allocation time
+    };
+
+    AllocHints() : alignment(0), flags(0) {}
+    explicit AllocHints(uint32_t alignment_, uint32_t flags_=0) :
+        alignment(alignment_), flags(flags_) {}
+
+    bool empty() const { return !alignment && !flags; }
+
+    uint32_t alignment;             // a power of two, or 0 for the default
+    uint32_t flags;
+};
+
+//  Hinted allocations are freed with the size and hints they were allocated
+//  with, so an allocator can tell page mappings from heap blocks.
+typedef void* (*AllocHintedFn)(void* context, int region, size_t sz,
+                               const AllocHints& hints);
+typedef void (*FreeHintedFn)(void* context, int region, void* ptr, size_t sz,
+                             const AllocHints& hints);
+
+//  When only AllocFn and FreeFn are supplied, hinted allocations are aligned
+//  within blocks from AllocFn.  The default allocator maps huge pages on
+//  Linux.  initialize also binds the SIMD kernels for the CPU; scalar
+//  kernels are used until it is called.  See avcpu.hpp.
 void initialize(AllocFn allocFn, FreeFn freeFn, void* context);
+void initialize(AllocFn allocFn, FreeFn freeFn,
+                AllocHintedFn allocHintedFn, FreeHintedFn freeHintedFn,
+                void* context);
+
+//  Allocation statistics for a memory region.  Counters are updated with
+//  relaxed atomics, so a snapshot taken while other threads allocate may be
+//  slightly inconsistent between fields.  Memory freed without a size is
+//  counted in freeCount only.
+struct MemoryStats
+{
+    uint64_t liveBytes;
+    uint64_t peakBytes;             // high-water mark of liveBytes
+    uint64_t allocCount;
+    uint64_t freeCount;
+};
+
+//  regions outside [0, kMemoryStatsRegionCount) share the last entry
+static const int kMemoryStatsRegionCount = 16;
+
+MemoryStats memoryStats(int region);
+//  copies the statistics of regions [0, count), returning the number copied
+int snapshotMemoryStats(MemoryStats* stats, int count);
+//  resets each region's high-water mark to its current live bytes
+void resetMemoryPeaks();
 
 struct Memory
 {
@@ -34,6 +94,9 @@ struct Memory
 
     void* allocate(size_t sz);
     void free(void* ptr);
+    void free(void* ptr, size_t sz);
+    void* allocate(size_t sz, const AllocHints& hints);
+    void free(void* ptr, size_t sz, const AllocHints& hints);
     
     template<typename T, typename... Args>
     T* create(Args&&... args)
@@ -47,7 +110,7 @@ struct Memory
     void destroy(T* ptr)
     {
         ptr->~T();
-        free(ptr);
+        free(ptr, sizeof(T));
     }
 
 private:
@@ -73,6 +136,7 @@ class Buffer
 public:
     Buffer(const Memory& memory=Memory());
     Buffer(int sz, const Memory& memory=Memory());
+    Buffer(int sz, const AllocHints& hints, const Memory& memory=Memory());
     Buffer(uint8_t* buffer, int sz);
     Buffer(uint8_t* buffer, int sz, int limit);
     ~Buffer();
@@ -161,6 +225,7 @@ public:
 private:
     friend class StringBuffer;
     Memory _memory;
+    AllocHints _hints;
     uint8_t* _buffer;
     uint8_t* _head;
     uint8_t* _tail;
@@ -176,15 +241,152 @@ public:
     StringBuffer(int sz, const Memory& memory=Memory());
     StringBuffer(Buffer&& buffer);
 
-    //  skips null characters if delim != 0.
-    //  else terminates on delim or end of buffer.
+    //  copies the next line, terminated by delim or the end of the buffer,
+    //  excluding delim (and a CR preceding a '\n' delim.)
     StringBuffer& getline(std::string& str, char delim='\n');
+    //  returns a view of the next line within the buffer, excluding delim
+    //  (and a CR preceding a '\n' delim.)
+    //  the view remains valid for the lifetime of the StringBuffer.
+    StringBuffer& getline(const char** str, size_t* len, char delim='\n');
 
     bool end() const;
 
 private:
+    const uint8_t* nextLine(const uint8_t** lineEnd, char delim);
+
     Buffer _buffer;
 };
+
+//  Streaming 64-bit content hash, using the xxHash64 algorithm.  Intended for
+//  detecting changed resources, not for security.
+class Hash64
+{
+public:
+    Hash64(uint64_t seed=0);
+
+    void reset(uint64_t seed=0);
+    void update(const void* data, size_t len);
+    uint64_t digest() const;
+
+    static uint64_t compute(const void* data, size_t len, uint64_t seed=0);
+
+private:
+    uint64_t _acc[4];
+    uint64_t _seed;
+    uint64_t _total;
+    uint8_t _pending[32];
+    uint32_t _pendingLen;
+};
+
+//  Resolves a uri reference against a base url (RFC 3986 section 5.2),
+//  replacing the contents of out with the target url.  With an empty base,
+//  the reference is copied as is.
+void resolveUrl(std::string& out, const char* base, size_t baseLen,
+                const char* ref, size_t refLen);
+
+//  Big-endian loads from unaligned memory.  These compile to a single load
+//  and byte swap on little-endian targets.
+inline uint16_t loadBE16(const uint8_t* p)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap16(v);
+#else
+    return (uint16_t)((p[0] << 8) | p[1]);
+#endif
+}
+
+inline uint32_t loadBE32(const uint8_t* p)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap32(v);
+#else
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+#endif
+}
+
+inline uint64_t loadBE64(const uint8_t* p)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap64(v);
+#else
+    return ((uint64_t)loadBE32(p) << 32) | loadBE32(p+4);
+#endif
+}
+
+//  Reads big-endian fields from a byte range.  Unlike Buffer::pullByte, reads
+//  are unchecked: callers check a group of fields at once with has(), then
+//  read the group.
+class ByteReader
+{
+public:
+    ByteReader() : _head(nullptr), _tail(nullptr) {}
+    ByteReader(const uint8_t* data, size_t len) :
+        _head(data), _tail(data + len) {}
+    explicit ByteReader(const Buffer& buffer) :
+        _head(buffer.head()), _tail(buffer.tail()) {}
+
+    bool has(size_t cnt) const { return (size_t)(_tail - _head) >= cnt; }
+    size_t size() const { return _tail - _head; }
+    const uint8_t* head() const { return _head; }
+
+    uint8_t u8() { return *(_head++); }
+    uint16_t u16() { uint16_t v = loadBE16(_head); _head += 2; return v; }
+    uint32_t u24() {
+        uint32_t v = ((uint32_t)loadBE16(_head) << 8) | _head[2];
+        _head += 3;
+        return v;
+    }
+    uint32_t u32() { uint32_t v = loadBE32(_head); _head += 4; return v; }
+    uint64_t u64() { uint64_t v = loadBE64(_head); _head += 8; return v; }
+    void skip(size_t cnt) { _head += cnt; }
+
+    //  checked skip, returns false without advancing if out of range
+    bool trySkip(size_t cnt) {
+        if (!has(cnt))
+            return false;
+        _head += cnt;
+        return true;
+    }
+
+private:
+    const uint8_t* _head;
+    const uint8_t* _tail;
+};
+
+//  Reads bit fields msb first, i.e. from codec headers.  Bits are consumed
+//  from a 64-bit cache refilled with whole-word loads.  Reads past the end
+//  return zero bits and set overflow().
+class BitReader
+{
+public:
+    BitReader(const uint8_t* data, size_t len);
+
+    //  reads 0 to 32 bits
+    uint32_t read(int bits);
+    bool readFlag() { return read(1) != 0; }
+    void skip(int bits);
+    //  unsigned Exp-Golomb code, ue(v) in ITU-T H.264
+    uint32_t readUE();
+
+    bool overflow() const { return _overflow; }
+    size_t bitsLeft() const { return (_tail - _head) * 8 + _cacheBits; }
+
+private:
+    void refill();
+
+    const uint8_t* _head;
+    const uint8_t* _tail;
+    uint64_t _cache;        // msb aligned
+    int _cacheBits;
+    bool _overflow;
+};
     
 
 /**
@@ -226,8 +428,8 @@ struct std_allocator
         return temp;
     }
     
-    void deallocate(pointer p, size_type) {
-    	_allocator.free((void* )p);
+    void deallocate(pointer p, size_type n) {
+    	_allocator.free((void* )p, n*sizeof(T));
     }
     size_type max_size() const {
         return std::numeric_limits<size_t>::max() / sizeof(T);
@@ -256,6 +458,93 @@ inline bool operator!=(const std_allocator<T, Allocator>& lha,
     return lha._allocator != rha._allocator;
 }
 
+//  A slice of memory referenced by a BufferChain, laid out like an iovec.
+struct BufferSlice
+{
+    const uint8_t* data;
+    size_t size;
+};
+
+//  A sequence of slices read as one logical byte range.  Slices are
+//  referenced, not copied, so their memory must outlive the chain.
+class BufferChain
+{
+public:
+    BufferChain(const Memory& memory=Memory());
+
+    //  appends a slice by reference.  a slice continuing the last slice in
+    //  memory extends it.
+    bool append(const uint8_t* data, size_t len);
+    void clear();
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    //  bytes allocated for the slice table
+    size_t memoryUsage() const;
+    size_t sliceCount() const { return _slices.size(); }
+    const BufferSlice& slice(size_t index) const { return _slices[index]; }
+
+    //  copies up to len bytes starting at offset, returning the count copied
+    size_t copyOut(size_t offset, uint8_t* dst, size_t len) const;
+    //  fills out with the slices covering [offset, offset+len), returning
+    //  the number of slices required, which may exceed maxSlices.
+    size_t gather(size_t offset, size_t len, BufferSlice* out,
+                  size_t maxSlices) const;
+
+private:
+    //  returns the index of the slice containing offset
+    size_t findSlice(size_t offset) const;
+
+    std::vector<BufferSlice, std_allocator<BufferSlice>> _slices;
+    std::vector<size_t, std_allocator<size_t>> _starts;     // slice offsets
+    size_t _size;
+};
+
+//  Copies a sequence of slices to contiguous memory.
+void copySlices(uint8_t* dst, const BufferSlice* slices, size_t count);
+
+//  A set of equally sized blocks carved from a caller supplied region.
+//  Blocks are reference counted so data can be handed to consumers on other
+//  threads; a block is reused only once every reference has been released.
+//  The pool and its region must outlive all references.
+class BlockPool
+{
+public:
+    struct Block
+    {
+        uint8_t* data;
+        std::atomic<uint32_t> refs;
+    };
+
+    BlockPool(const Memory& memory=Memory());
+    ~BlockPool();
+
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    //  divides region into blockCount blocks.  fails if blocks are held.
+    bool reset(uint8_t* region, size_t size, int blockCount);
+
+    //  returns a free block holding one reference, or null if all are held
+    Block* acquire();
+
+    static void addRef(Block* block);
+    static void release(Block* block);
+    static uint32_t refCount(const Block* block);
+
+    size_t blockSize() const { return _blockSize; }
+    int blockCount() const { return _blockCount; }
+    int freeCount() const;
+
+private:
+    void freeBlocks();
+
+    Memory _memory;
+    Block* _blocks;
+    int _blockCount;
+    size_t _blockSize;
+};
+
 }   /* namespace cinekav */
 
 #endif
@@ -70,18 +70,25 @@ public:
 
     //  A request handle of 0 is considered invalid (null)
     //  A file handle of 0 is considered invalid (null)
+    //  The result of a completed read request is the number of bytes read.
+    //  A read may return fewer bytes than requested.
 
     using OpenCb = std::function<uint32_t(const char* url)>;
     using CloseCb = std::function<void(uintptr_t hnd)>;
     using ReadCb = std::function<uint32_t(uintptr_t hnd, uint8_t* p, size_t cnt)>;
     using SizeCb = std::function<size_t(uintptr_t hnd)>;
     using ResultCb = std::function<Result(uint32_t poll, uintptr_t* result)>;
+    //  Optional.  Returns a monotonic time in microseconds, used to pace
+    //  live playlist refreshes.  Without it, refreshes are paced by the
+    //  system's monotonic clock.
+    using TimeCb = std::function<uint64_t()>;
 
     OpenCb openCb;
     SizeCb sizeCb;
     CloseCb closeCb;
     ReadCb readCb;
     ResultCb resultCb;
+    TimeCb timeCb;
 };
 
 class Stream
@@ -0,0 +1,748 @@
+/**
+ *  @file       benchmark.cpp
+ *  @brief      Micro-benchmarks of the library's hot paths
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#include "hlstream.hpp"
+#include "avcpu.hpp"
+#include "synth.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace cinekav;
+
+//  Timings vary between machines, so each benchmark is scored as its ns per
+//  operation divided by the ns per byte of a fixed calibration loop.  The
+//  suite is run several times and each benchmark is scored on its median
+//  run, so a single slow or fast run moves neither the score nor the
+//  baseline.  Scores are compared against the baseline, which should be
+//  regenerated with --write-baseline when the reference machine or compiler
+//  changes.  Host load can shift memory bound timings for tens of seconds at
+//  a time, which calibration does not follow, so the stored baseline takes
+//  the median of several invocations spread over a few minutes.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedNs(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+//  results are accumulated here so the optimizer keeps the work
+volatile uint64_t gSink;
+
+////////////////////////////////////////////////////////////////////////////////
+//  Synthetic inputs
+//
+//  All inputs are generated from a fixed seed, so every run measures the
+//  same bytes.
+
+using synth::Bytes;
+
+//  A segment of 29.97 fps H.264 video and AAC audio, with an IDR frame
+//  about every second.
+Bytes makeSegment(uint32_t seed, int frames)
+{
+    synth::Config config;
+    config.seed = seed;
+    config.videoKbps = 1200;
+    synth::Generator generator(config);
+    Bytes ts;
+    generator.generateSegment(frames, ts);
+    return ts;
+}
+
+std::string makeMediaPlaylist(int segments)
+{
+    std::string text = "#EXTM3U\n#EXT-X-VERSION:4\n#EXT-X-TARGETDURATION:7\n"
+                       "#EXT-X-MEDIA-SEQUENCE:1000\n";
+    char line[128];
+    for (int i = 0; i < segments; ++i)
+    {
+        if (i % 100 == 0)
+            text += "#EXT-X-DISCONTINUITY\n";
+        snprintf(line, sizeof(line), "#EXTINF:%d.%03d,\n", 5 + i % 2,
+                 (i * 337) % 1000);
+        text += line;
+        snprintf(line, sizeof(line), "segments/720p/segment_%06d.ts\n", i);
+        text += line;
+    }
+    text += "#EXT-X-ENDLIST\n";
+    return text;
+}
+
+std::string makeMasterPlaylist(int variants)
+{
+    std::string text = "#EXTM3U\n#EXT-X-VERSION:4\n";
+    char line[512];
+    for (int i = 0; i < variants; ++i)
+    {
+        int height = 144 + (i % 8) * 120;
+        snprintf(line, sizeof(line),
+                 "#EXT-X-STREAM-INF:BANDWIDTH=%d,AVERAGE-BANDWIDTH=%d,"
+                 "CODECS=\"avc1.4d40%02x,mp4a.40.2\",RESOLUTION=%dx%d,"
+                 "FRAME-RATE=%s,AUDIO=\"aac\",CLOSED-CAPTIONS=NONE\n"
+                 "variant_%d/index.m3u8\n",
+                 200000 + i * 150000, 180000 + i * 140000, 0x15 + i % 16,
+                 height * 16 / 9, height, (i % 2) ? "29.970" : "59.940", i);
+        text += line;
+    }
+    return text;
+}
+
+//  Serves in-memory files to an HLStream.  Requests complete immediately.
+class MemoryInput
+{
+public:
+    void add(const std::string& url, const Bytes* data)
+    {
+        _files.push_back(File { url, data });
+    }
+
+    StreamInputCallbacks callbacks()
+    {
+        StreamInputCallbacks cbs;
+        cbs.openCb = [this](const char* url) -> uint32_t
+        {
+            uintptr_t handle = 0;
+            for (auto& file : _files)
+            {
+                if (file.url == url)
+                {
+                    _handles.push_back(Handle { file.data, 0 });
+                    handle = _handles.size();
+                    break;
+                }
+            }
+            return complete(handle);
+        };
+        cbs.sizeCb = [this](uintptr_t handle) -> size_t
+        {
+            return _handles[handle-1].data->size();
+        };
+        cbs.closeCb = [](uintptr_t) {};
+        cbs.readCb = [this](uintptr_t handle, uint8_t* p, size_t cnt) -> uint32_t
+        {
+            Handle& h = _handles[handle-1];
+            size_t n = std::min(cnt, h.data->size() - h.pos);
+            memcpy(p, h.data->data() + h.pos, n);
+            h.pos += n;
+            return complete(n);
+        };
+        cbs.resultCb = [this](uint32_t request, uintptr_t* result)
+        {
+            if (!request || request > _results.size())
+                return StreamInputCallbacks::Result::kInvalid;
+            *result = _results[request-1];
+            return *result ? StreamInputCallbacks::Result::kComplete :
+                             StreamInputCallbacks::Result::kError;
+        };
+        return cbs;
+    }
+
+private:
+    uint32_t complete(uintptr_t result)
+    {
+        _results.push_back(result);
+        return (uint32_t)_results.size();
+    }
+
+    struct File
+    {
+        std::string url;
+        const Bytes* data;
+    };
+    struct Handle
+    {
+        const Bytes* data;
+        size_t pos;
+    };
+    std::vector<File> _files;
+    std::vector<Handle> _handles;
+    std::vector<uintptr_t> _results;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//  Benchmarks
+
+struct Benchmark
+{
+    const char* name;
+    const char* unit;               // what one operation is
+    std::function<uint64_t()> run;  // returns the operations performed
+};
+
+struct Inputs
+{
+    Bytes segment;                  // TS
+    std::vector<Bytes> segments;    // TS segments of the HLS stream
+    Bytes h264;                     // H.264 byte stream
+    std::vector<size_t> h264Frames; // frame sizes within h264
+    Bytes mediaPlaylist;
+    Bytes masterPlaylist;
+    Bytes hlsMaster;                // HLS stream playlists
+    Bytes hlsMedia;
+    Bytes scratch;                  // output for copies
+    Bytes workingSet;               // read between copies
+    Buffer streamBuffers;           // HLStream video and audio buffers
+};
+
+const size_t kPlaylistChunkSize = 16*1024;
+const int kHLSSegmentCount = 4;
+const int kVideoBufferSize = 8*1024*1024;
+const int kAudioBufferSize = 2*1024*1024;
+//  stands in for the demuxer and decoder state a copy could evict
+const size_t kWorkingSetSize = 1024*1024;
+
+void makeInputs(Inputs& in)
+{
+    in.segment = makeSegment(1, 300);
+    for (int i = 0; i < kHLSSegmentCount; ++i)
+        in.segments.push_back(makeSegment(100 + i, 60));
+
+    synth::Random rnd(2);
+    for (int frame = 0; frame < 300; ++frame)
+    {
+        size_t size = in.h264.size();
+        bool idr = frame % 30 == 0;
+        synth::appendH264Frame(in.h264, rnd, idr ? rnd.range(16000, 24000) :
+                                                   rnd.range(1500, 6000), idr);
+        in.h264Frames.push_back(in.h264.size() - size);
+    }
+
+    std::string text = makeMediaPlaylist(5000);
+    in.mediaPlaylist.assign(text.begin(), text.end());
+    text = makeMasterPlaylist(256);
+    in.masterPlaylist.assign(text.begin(), text.end());
+
+    text = "#EXTM3U\n#EXT-X-STREAM-INF:BANDWIDTH=2000000\nmedia.m3u8\n";
+    in.hlsMaster.assign(text.begin(), text.end());
+    text = "#EXTM3U\n#EXT-X-TARGETDURATION:2\n#EXT-X-MEDIA-SEQUENCE:0\n";
+    for (int i = 0; i < kHLSSegmentCount; ++i)
+        text += "#EXTINF:2.002,\nsegment" + std::to_string(i) + ".ts\n";
+    text += "#EXT-X-ENDLIST\n";
+    in.hlsMedia.assign(text.begin(), text.end());
+
+    in.scratch.resize(std::max<size_t>(in.segment.size(), kVideoBufferSize +
+                                                         kAudioBufferSize));
+    in.workingSet.assign(kWorkingSetSize, 1);
+    //  allocated as a player would, so runs don't time page faults
+    in.streamBuffers = Buffer(kVideoBufferSize + kAudioBufferSize,
+                              AllocHints(64, AllocHints::kHugePages |
+                                             AllocHints::kPrefault));
+}
+
+uint64_t runDemux(Inputs& in, bool gather)
+{
+    ElementaryStream streams[4];
+    size_t streamCount = 0;
+    int half = (int)in.scratch.size() / 2;
+
+    mpegts::Demuxer demuxer(
+        [&](ElementaryStream::Type type, uint16_t progId) -> ElementaryStream*
+        {
+            if (streamCount == 4)
+                return nullptr;
+            uint8_t index = (uint8_t)(streamCount + 1);
+            ElementaryStream& stream = streams[streamCount++];
+            if (gather)
+            {
+                stream = ElementaryStream(type, progId, index);
+            }
+            else
+            {
+                //  video and audio share the scratch buffer
+                uint8_t* p = in.scratch.data() + (index == 1 ? 0 : half);
+                stream = ElementaryStream(Buffer(p, 0, half), type, progId,
+                                          index);
+            }
+            return &stream;
+        },
+        [&](uint16_t, uint16_t index) -> ElementaryStream*
+        {
+            return index && index <= streamCount ? &streams[index-1] : nullptr;
+        },
+        [](uint16_t, uint16_t) {},
+        [](uint16_t, uint16_t, uint32_t) -> ElementaryStream* {
+            return nullptr;
+        });
+
+    Buffer input(in.segment.data(), (int)in.segment.size());
+    if (demuxer.read(input) != mpegts::Demuxer::kComplete)
+        return 0;
+    gSink += streams[0].accessUnitCount();
+    return in.segment.size() / mpegts::kDefaultPacketSize;
+}
+
+uint64_t runHLStream(Inputs& in)
+{
+    MemoryInput input;
+    input.add("http://bench/master.m3u8", &in.hlsMaster);
+    input.add("http://bench/media.m3u8", &in.hlsMedia);
+    for (int i = 0; i < kHLSSegmentCount; ++i)
+    {
+        input.add("http://bench/segment" + std::to_string(i) + ".ts",
+                  &in.segments[i]);
+    }
+
+    uint8_t* video = in.streamBuffers.obtain(0);
+    uint8_t* audio = video + kVideoBufferSize;
+    HLStream stream(input.callbacks(),
+                    Buffer(video, 0, kVideoBufferSize),
+                    Buffer(audio, 0, kAudioBufferSize),
+                    "http://bench/master.m3u8");
+
+    //  the stream is drained once updates stop producing units
+    uint64_t units = 0;
+    for (int idle = 0; idle < 256; )
+    {
+        stream.update();
+        ESAccessUnit vau, aau;
+        int result = stream.pullEncodedData(&vau, &aau);
+        if (result)
+        {
+            units += (result & 1) + ((result >> 1) & 1);
+            idle = 0;
+        }
+        else
+        {
+            ++idle;
+        }
+    }
+    return units;
+}
+
+//  With workingSet, a byte of every working set cache line is read after each
+//  run, so the time includes reloading whatever the copy evicted.
+uint64_t runCopySlices(Inputs& in, bool workingSet)
+{
+    //  the payload of each packet, copied in runs of 64 as the demuxer does
+    const size_t kRun = 64;
+    BufferSlice slices[kRun];
+    const uint8_t* src = in.segment.data();
+    size_t packets = in.segment.size() / mpegts::kDefaultPacketSize;
+    uint8_t* dst = in.scratch.data();
+    uint64_t bytes = 0;
+    for (size_t i = 0; i + kRun <= packets; i += kRun)
+    {
+        for (size_t j = 0; j < kRun; ++j)
+        {
+            slices[j].data = src + (i + j) * mpegts::kDefaultPacketSize + 4;
+            slices[j].size = mpegts::kDefaultPacketSize - 4;
+        }
+        copySlices(dst, slices, kRun);
+        dst += kRun * (mpegts::kDefaultPacketSize - 4);
+        bytes += kRun * (mpegts::kDefaultPacketSize - 4);
+        if (workingSet)
+        {
+            uint64_t sum = 0;
+            for (size_t k = 0; k < in.workingSet.size(); k += 64)
+                sum += in.workingSet[k];
+            gSink += sum;
+        }
+    }
+    return bytes;
+}
+
+std::vector<Benchmark> makeBenchmarks(Inputs& in)
+{
+    std::vector<Benchmark> benchmarks;
+
+    benchmarks.push_back(Benchmark { "buffer.pull_uint", "byte", [&in]()
+    {
+        Buffer buffer(in.segment.data(), (int)in.segment.size());
+        uint64_t sum = 0;
+        while (buffer.size() >= 7)
+        {
+            sum += buffer.pullUInt32();
+            sum += buffer.pullUInt16();
+            sum += buffer.pullByte();
+        }
+        gSink += sum;
+        return (uint64_t)in.segment.size();
+    }});
+
+    benchmarks.push_back(Benchmark { "buffer.pull_bytes_from", "byte", [&in]()
+    {
+        Buffer source(in.segment.data(), (int)in.segment.size());
+        Buffer packet(in.scratch.data(), 0, mpegts::kDefaultPacketSize);
+        int pulled = 0;
+        uint64_t bytes = 0;
+        do
+        {
+            packet.reset();
+            packet.pullBytesFrom(source, mpegts::kDefaultPacketSize, &pulled);
+            bytes += pulled;
+        }
+        while (pulled);
+        return bytes;
+    }});
+
+    benchmarks.push_back(Benchmark { "demux.parse_packet", "packet", [&in]()
+    {
+        return runDemux(in, false);
+    }});
+
+    benchmarks.push_back(Benchmark { "demux.parse_packet_gather", "packet",
+                                     [&in]()
+    {
+        return runDemux(in, true);
+    }});
+
+    benchmarks.push_back(Benchmark { "es.parse_h264_stream", "byte", [&in]()
+    {
+        //  one PES per frame, as demuxed
+        ElementaryStream stream(Buffer(in.scratch.data(), 0,
+                                       (int)in.scratch.size()),
+                                ElementaryStream::kVideo_H264, 1, 1);
+        const uint8_t* frame = in.h264.data();
+        for (size_t size : in.h264Frames)
+        {
+            stream.appendPayload(frame, (uint32_t)size, true);
+            frame += size;
+        }
+        gSink += stream.accessUnitCount();
+        return (uint64_t)in.h264.size();
+    }});
+
+    benchmarks.push_back(Benchmark { "copy.slices", "byte", [&in]()
+    {
+        return runCopySlices(in, false);
+    }});
+
+    benchmarks.push_back(Benchmark { "copy.slices_working_set", "byte", [&in]()
+    {
+        return runCopySlices(in, true);
+    }});
+
+    benchmarks.push_back(Benchmark { "string.getline", "line", [&in]()
+    {
+        StringBuffer text(Buffer(in.mediaPlaylist.data(),
+                                 (int)in.mediaPlaylist.size()));
+        std::string line;
+        uint64_t lines = 0;
+        while (!text.end())
+        {
+            text.getline(line);
+            gSink += line.size();
+            ++lines;
+        }
+        return lines;
+    }});
+
+    benchmarks.push_back(Benchmark { "string.getline_view", "line", [&in]()
+    {
+        StringBuffer text(Buffer(in.mediaPlaylist.data(),
+                                 (int)in.mediaPlaylist.size()));
+        const char* line;
+        size_t len;
+        uint64_t lines = 0;
+        while (!text.end())
+        {
+            text.getline(&line, &len);
+            gSink += len;
+            ++lines;
+        }
+        return lines;
+    }});
+
+    benchmarks.push_back(Benchmark { "playlist.media_parse", "byte", [&in]()
+    {
+        HLSPlaylist playlist("http://bench/live/index.m3u8");
+        HLSPlaylistParser parser;
+        const char* text = reinterpret_cast<const char*>(
+            in.mediaPlaylist.data());
+        for (size_t pos = 0; pos < in.mediaPlaylist.size();
+             pos += kPlaylistChunkSize)
+        {
+            parser.feed(playlist, text + pos,
+                        std::min(kPlaylistChunkSize,
+                                 in.mediaPlaylist.size() - pos));
+        }
+        parser.finish(playlist);
+        gSink += playlist.segmentCount();
+        return (uint64_t)in.mediaPlaylist.size();
+    }});
+
+    benchmarks.push_back(Benchmark { "playlist.master_parse", "byte", [&in]()
+    {
+        HLSMasterPlaylist playlist;
+        HLSMasterPlaylistParser parser("http://bench/master.m3u8");
+        parser.feed(playlist,
+                    reinterpret_cast<const char*>(in.masterPlaylist.data()),
+                    in.masterPlaylist.size());
+        parser.finish(playlist);
+        gSink += playlist.streamCount();
+        return (uint64_t)in.masterPlaylist.size();
+    }});
+
+    benchmarks.push_back(Benchmark { "hlstream.pull_encoded_data", "AU",
+                                     [&in]()
+    {
+        return runHLStream(in);
+    }});
+
+    return benchmarks;
+}
+
+//  FNV-1a over a fixed buffer.  Its ns per byte is the unit of all scores.
+uint64_t runCalibration(Inputs& in)
+{
+    const size_t kSize = 64*1024;
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < kSize; ++i)
+    {
+        hash ^= in.segment[i];
+        hash *= 1099511628211ull;
+    }
+    gSink += hash;
+    return kSize;
+}
+
+const int kSampleCount = 3;
+const double kSampleNs = 50e6;
+
+//  returns the best ns per operation across samples, filtering out samples
+//  interrupted by the scheduler
+double measure(const std::function<uint64_t()>& fn)
+{
+    fn();
+    double best = 0.0;
+    for (int sample = 0; sample < kSampleCount; ++sample)
+    {
+        uint64_t ops = 0;
+        double ns = 0.0;
+        auto start = Clock::now();
+        do
+        {
+            ops += fn();
+            ns = elapsedNs(start, Clock::now());
+        }
+        while (ns < kSampleNs);
+        if (!ops)
+            return -1.0;
+        double perOp = ns / ops;
+        best = sample ? std::min(best, perOp) : perOp;
+    }
+    return best;
+}
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    if (values.size() % 2)
+        return values[mid];
+    return (values[mid-1] + values[mid]) / 2;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//  Baselines
+
+struct Score
+{
+    std::string name;
+    double score;
+};
+
+bool readBaseline(const char* path, std::vector<Score>& scores)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp)
+        return false;
+    char line[256];
+    while (fgets(line, sizeof(line), fp))
+    {
+        char name[128];
+        double score;
+        if (line[0] == '#' || sscanf(line, "%127s %lf", name, &score) != 2)
+            continue;
+        scores.push_back(Score { name, score });
+    }
+    fclose(fp);
+    return true;
+}
+
+bool writeBaseline(const char* path, const std::vector<Score>& scores)
+{
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+        return false;
+    fprintf(fp, "# ckavbench baseline.  Scores are ns per operation divided by "
+                "the\n# calibration loop's ns per byte, from the median run; "
+                "lower is faster.\n");
+    for (auto& score : scores)
+        fprintf(fp, "%s %.4f\n", score.name.c_str(), score.score);
+    return fclose(fp) == 0;
+}
+
+const Score* findScore(const std::vector<Score>& scores, const char* name)
+{
+    for (auto& score : scores)
+    {
+        if (score.name == name)
+            return &score;
+    }
+    return nullptr;
+}
+
+void printUsage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --baseline FILE        compare against FILE, failing on regressions\n"
+        "  --write-baseline FILE  write this run's scores to FILE\n"
+        "  --tolerance PCT        allowed slowdown (default 25)\n"
+        "  --runs N               runs of the suite to take the median of\n"
+        "                         (default 5)\n"
+        "  --filter TEXT          run benchmarks whose name contains TEXT\n"
+        "  --scalar               use the scalar kernels only\n", name);
+}
+
+} /* anonymous namespace */
+
+int main(int argc, const char* argv[])
+{
+    const char* baselinePath = nullptr;
+    const char* writePath = nullptr;
+    const char* filter = nullptr;
+    double tolerance = 25.0;
+    int runs = 5;
+    bool scalar = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i+1 < argc ? argv[i+1] : nullptr;
+        if (!strcmp(arg, "--baseline") && value)
+            baselinePath = argv[++i];
+        else if (!strcmp(arg, "--write-baseline") && value)
+            writePath = argv[++i];
+        else if (!strcmp(arg, "--filter") && value)
+            filter = argv[++i];
+        else if (!strcmp(arg, "--tolerance") && value)
+            tolerance = atof(argv[++i]);
+        else if (!strcmp(arg, "--runs") && value && atoi(value) > 0)
+            runs = atoi(argv[++i]);
+        else if (!strcmp(arg, "--scalar"))
+            scalar = true;
+        else
+        {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<Score> baseline;
+    if (baselinePath && !readBaseline(baselinePath, baseline))
+    {
+        fprintf(stderr, "%s: unable to read baseline\n", baselinePath);
+        return 2;
+    }
+
+    cpu::bindKernels(scalar ? 0 : ~0u);
+
+    Inputs inputs;
+    makeInputs(inputs);
+    std::vector<Benchmark> benchmarks;
+    for (auto& benchmark : makeBenchmarks(inputs))
+    {
+        if (!filter || strstr(benchmark.name, filter))
+            benchmarks.push_back(benchmark);
+    }
+
+    //  each measurement is calibrated just before it is taken, so its score
+    //  is relative to the machine's speed at the time
+    std::vector<double> unitRuns;
+    std::vector<std::vector<double>> nsRuns(benchmarks.size());
+    std::vector<std::vector<double>> scoreRuns(benchmarks.size());
+    std::vector<bool> failed(benchmarks.size(), false);
+    for (int run = 0; run < runs; ++run)
+    {
+        for (size_t i = 0; i < benchmarks.size(); ++i)
+        {
+            if (failed[i])
+                continue;
+            double unitNs = measure([&inputs]()
+            {
+                return runCalibration(inputs);
+            });
+            unitRuns.push_back(unitNs);
+            double ns = measure(benchmarks[i].run);
+            if (ns < 0.0)
+            {
+                failed[i] = true;
+                continue;
+            }
+            nsRuns[i].push_back(ns);
+            scoreRuns[i].push_back(ns / unitNs);
+        }
+    }
+
+    if (unitRuns.empty())
+        unitRuns.push_back(0.0);
+    printf("calibration: %.4f ns/byte, median of %d runs\n",
+           median(unitRuns), runs);
+    printf("%-28s %6s %12s %14s %10s %10s\n", "benchmark", "unit", "ns/op",
+           "ops/s", "score", "baseline");
+
+    int regressions = 0;
+    std::vector<Score> scores;
+    for (size_t i = 0; i < benchmarks.size(); ++i)
+    {
+        auto& benchmark = benchmarks[i];
+        if (failed[i])
+        {
+            printf("%-28s failed\n", benchmark.name);
+            ++regressions;
+            continue;
+        }
+        double ns = median(nsRuns[i]);
+        double score = median(scoreRuns[i]);
+        scores.push_back(Score { benchmark.name, score });
+
+        printf("%-28s %6s %12.3f %14.0f %10.4f", benchmark.name,
+               benchmark.unit, ns, 1e9 / ns, score);
+        const Score* base = findScore(baseline, benchmark.name);
+        if (base)
+        {
+            double change = (score / base->score - 1.0) * 100.0;
+            printf(" %10.4f %+6.1f%%", base->score, change);
+            if (change > tolerance)
+            {
+                printf("  REGRESSION");
+                ++regressions;
+            }
+        }
+        else if (baselinePath)
+        {
+            printf(" %10s", "new");
+        }
+        printf("\n");
+    }
+
+    if (writePath && !writeBaseline(writePath, scores))
+    {
+        fprintf(stderr, "%s: unable to write baseline\n", writePath);
+        return 2;
+    }
+    if (regressions)
+    {
+        printf("%d benchmark(s) regressed more than %.0f%%\n", regressions,
+               tolerance);
+        return 1;
+    }
+    return 0;
+}
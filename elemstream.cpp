@@ -8,11 +8,13 @@
  */
 
 #include "elemstream.hpp"
-#include <cassert>
+#include "avcodecs.hpp"
+#include "avcpu.hpp"
 
 namespace cinekav {
 
 ElementaryStream::ElementaryStream() :
+    _gather(false),
     _type(kNull),
     _progId(0),
     _index(0),
@@ -34,6 +36,24 @@ ElementaryStream::ElementaryStream(Buffer&& buffer, Type type, uint16_t progId,
                                    const Memory& memory) :
     _memory(memory),
     _buffer(std::move(buffer)),
+    _chain(memory),
+    _gather(false),
+    _type(type),
+    _progId(progId),
+    _index(index),
+    _streamId(0),
+    _dts(0),
+    _pts(0),
+    _ESAUBatch(nullptr),
+    _ESAccessUnitCount(0)
+{
+}
+
+ElementaryStream::ElementaryStream(Type type, uint16_t progId, uint8_t index,
+                                   const Memory& memory) :
+    _memory(memory),
+    _chain(memory),
+    _gather(true),
     _type(type),
     _progId(progId),
     _index(index),
@@ -48,6 +68,8 @@ ElementaryStream::ElementaryStream(Buffer&& buffer, Type type, uint16_t progId,
 ElementaryStream::ElementaryStream(ElementaryStream&& other) :
     _memory(std::move(other._memory)),
     _buffer(std::move(other._buffer)),
+    _chain(std::move(other._chain)),
+    _gather(other._gather),
     _type(other._type),
     _progId(other._progId),
     _index(other._index),
@@ -75,6 +97,8 @@ ElementaryStream& ElementaryStream::operator=(ElementaryStream&& other)
 
     _memory = std::move(other._memory);
     _buffer = std::move(other._buffer);
+    _chain = std::move(other._chain);
+    _gather = other._gather;
     _type = other._type;
     _progId = other._progId;
     _index = other._index;
@@ -103,7 +127,8 @@ void ElementaryStream::freeESAUBatches()
     while (_ESAUBatch)
     {
         ESAccessUnitBatch* next = _ESAUBatch->nextBatch;
-        _memory.free(_ESAUBatch->head);
+        _memory.free(_ESAUBatch->head,
+                     sizeof(ESAccessUnit) * (_ESAUBatch->limit - _ESAUBatch->head));
         _memory.destroy(_ESAUBatch);
         _ESAUBatch = next;
     }
@@ -112,42 +137,65 @@ void ElementaryStream::freeESAUBatches()
 
 uint32_t ElementaryStream::appendPayload(Buffer& source, uint32_t len, bool pesStart)
 {
-    if (len > _buffer.available())
+    if (len > (uint32_t)source.size())
+        len = source.size();
+    uint32_t overflow = appendPayload(source.head(), len, pesStart);
+    if (!overflow)
+        source.skip(len);
+    return overflow;
+}
+
+uint32_t ElementaryStream::appendPayload(const uint8_t* data, uint32_t len,
+                                         bool pesStart)
+{
+    BufferSlice slice = { data, len };
+    return appendPayload(&slice, 1, pesStart);
+}
+
+uint32_t ElementaryStream::appendPayload(const BufferSlice* slices,
+                                         size_t count,
+                                         bool pesStart)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i)
     {
-        return len - _buffer.available();
+        len += slices[i].size;
     }
 
-    //  call out the start of our parsing region (the portion of the buffer
-    //  to search for access units
-    if (!_parser.head)
+    size_t offset = _gather ? _chain.size() : _buffer.size();
+    if (_gather)
     {
-        _parser.head = _buffer.head();
-        _parser.tail = _parser.head;
-        _parser.auStart = nullptr;
-        _parser.VCLcheck = false;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!_chain.append(slices[i].data, slices[i].size))
+                return (uint32_t)(offset + len - _chain.size());
+        }
     }
-    
-    //  len will be zero if there is no tail buffer.
-    if (len == 0)
-        return len;
-    
-    int pulled = 0;
-    _buffer.pullBytesFrom(source, len, &pulled);
-    len -= pulled;
-    assert(len == 0);   // first length check should've prevented this
-
-    //  the current end of buffer marker (limit of parsing.)
-    _parser.tail = _buffer.tail();
-
-    //  Parse from our current head to tail for access units.  We parse during
-    //  buffer generation so we can assign the current dts/pts markers to 
-    //  frames.
-    if (_type == kVideo_H264)
+    else
     {
-        parseH264Stream();
+        if (len > (size_t)_buffer.available())
+        {
+            return (uint32_t)(len - _buffer.available());
+        }
+        //  len will be zero if there is no tail buffer.
+        if (len == 0)
+            return 0;
+
+        copySlices(_buffer.obtain((int)len), slices, count);
     }
-   
-    return len;
+
+    //  Parse the new payload for access units as it is appended, so the
+    //  current dts/pts markers can be assigned to frames.  The source is
+    //  scanned rather than the copy, which is the same in both buffer modes.
+    if (codecs::kStreamTypeTable[_type].parser == codecs::kParser_H264)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            parseH264Stream(slices[i].data, slices[i].size, offset);
+            offset += slices[i].size;
+        }
+    }
+    return 0;
 }
 
 void ElementaryStream::updatePts(uint64_t pts)
@@ -162,41 +210,57 @@ void ElementaryStream::updatePtsDts(uint64_t pts, uint64_t dts)
     _pts = pts;
 }
 
-void ElementaryStream::appendAccessUnit(const uint8_t* data, size_t size)
+void ElementaryStream::appendAccessUnit(const uint8_t* data, size_t offset,
+                                        size_t size)
 {
-    ESAccessUnitBatch* auBatch = _ESAUBatch ? _ESAUBatch : nullptr;
-    if (!auBatch)
+    //  batches are listed in order from _ESAUBatch.  units are appended to
+    //  the last batch.
+    ESAccessUnitBatch* auBatch = _ESAUBatch;
+    while (auBatch && auBatch->nextBatch)
     {
-        auBatch = _memory.create<ESAccessUnitBatch>();
+        auBatch = auBatch->nextBatch;
     }
-    if (auBatch)
+    if (!auBatch || auBatch->tail == auBatch->limit)
     {
-        if (!auBatch->head)
-        {
-            auBatch->head = reinterpret_cast<ESAccessUnit*>(
-                _memory.allocate(sizeof(ESAccessUnit)*kAccessUnitCount)
-                );
-            auBatch->tail = auBatch->head;
-            auBatch->limit = auBatch->tail + kAccessUnitCount;
-        }
-        else if (auBatch->tail == auBatch->limit)
+        //  new batch
+        ESAccessUnitBatch* batch = _memory.create<ESAccessUnitBatch>();
+        if (!batch)
+            return;
+        batch->head = reinterpret_cast<ESAccessUnit*>(
+            _memory.allocate(sizeof(ESAccessUnit)*kAccessUnitCount)
+            );
+        if (!batch->head)
         {
-            //  new batch
-            auBatch->nextBatch = _memory.create<ESAccessUnitBatch>();
-            auBatch = auBatch->nextBatch;
+            _memory.destroy(batch);
+            return;
         }
+        batch->tail = batch->head;
+        batch->limit = batch->tail + kAccessUnitCount;
+        if (auBatch)
+            auBatch->nextBatch = batch;
+        else
+            _ESAUBatch = batch;
+        auBatch = batch;
     }
-    if (!auBatch)
+    auBatch->tail->data = data;
+    auBatch->tail->dataSize = size;
+    auBatch->tail->offset = offset;
+    auBatch->tail->dts = _dts;
+    auBatch->tail->pts = _pts;
+    auBatch->tail->block = nullptr;
+    ++auBatch->tail;
+    ++_ESAccessUnitCount;
+}
+
+size_t ElementaryStream::memoryUsage() const
+{
+    size_t usage = _chain.memoryUsage();
+    for (auto batch = _ESAUBatch; batch; batch = batch->nextBatch)
     {
-        return;
+        usage += sizeof(ESAccessUnitBatch) +
+                 (batch->limit - batch->head) * sizeof(ESAccessUnit);
     }
-    _ESAUBatch = auBatch;
-    _ESAUBatch->tail->data = data;
-    _ESAUBatch->tail->dataSize = size;
-    _ESAUBatch->tail->dts = _dts;
-    _ESAUBatch->tail->pts = _pts;
-    ++_ESAUBatch->tail;
-    ++_ESAccessUnitCount;
+    return usage;
 }
 
 ESAccessUnit* ElementaryStream::accessUnit(size_t index)
@@ -216,86 +280,120 @@ ESAccessUnit* ElementaryStream::accessUnit(size_t index)
     return nullptr;
 }
 
+size_t ElementaryStream::gatherAccessUnit(const ESAccessUnit& au,
+                                          BufferSlice* slices,
+                                          size_t maxSlices) const
+{
+    if (_gather)
+        return _chain.gather(au.offset, au.dataSize, slices, maxSlices);
+    if (maxSlices)
+    {
+        slices[0].data = au.data;
+        slices[0].size = au.dataSize;
+    }
+    return 1;
+}
+
 #if CINEK_AVLIB_IOSTREAMS
 std::basic_ostream<char>& ElementaryStream::write(std::basic_ostream<char>& ostr) const
 {
+    if (_gather)
+    {
+        for (size_t i = 0; i < _chain.sliceCount(); ++i)
+        {
+            ostr.write((const char*)_chain.slice(i).data, _chain.slice(i).size);
+        }
+        return ostr;
+    }
     ostr.write((const char*)_buffer.head(), _buffer.size());
     return ostr;
 }
 #endif
 
-void ElementaryStream::parseH264Stream()
+//  approximation of Fig 7-1 from the ITU-T H.264 spec (2012)
+//  An access unit contains non-VCL NAL units first, followed by VCL units.
+//  Returns true if the NAL unit with the given header begins a new access
+//  unit.  slice holds the bytes following the NAL header.
+bool ElementaryStream::startsH264AccessUnit(uint8_t nalHeader,
+                                            const uint8_t* slice,
+                                            size_t sliceLen)
 {
-    while (_parser.head+4 < _parser.tail)
+    switch (codecs::kH264NalTable[nalHeader].role)
     {
-        //  detect start of NAL unit
-        const uint8_t* hdr = _parser.head;
-        bool ACUfinish = false;
-
-        if (!hdr[0] && !hdr[1] && hdr[2] == 0x01)
+    case codecs::kNalRole_Leading:
+        //  the first non-VCL unit after a picture starts the next unit
+        if (_parser.VCLcheck)
+            return false;
+        _parser.VCLcheck = true;
+        return true;
+    case codecs::kNalRole_VCL:
+        //  the slice ending the non-VCL units leading an access unit
+        if (_parser.VCLcheck)
         {
-            //  0x000001 found, marking the start of a NAL unit
-            //  next byte contains nal unit type (5 bits lsb)
-            uint8_t NALType = hdr[3] & 0x1f;
-
-            //  approximation of Fig 7-1 from the ITU-T H.264 spec (2012)
-            //  A video frame contains non-VCL NAL units first, followed by
-            //  VCL units.
-            if (NALType > 0x00 && NALType < 0x0a)   // EndOfSeq
-            {
-                if (_parser.VCLcheck)
-                {
-                    if (NALType < 0x06)             // VCL 
-                    {
-                        _parser.VCLcheck = false;
-                    }
-                }
-                else
-                {
-                    if (NALType >= 0x06)            // Non-VCL
-                    {
-                        _parser.VCLcheck = true;
-                        if (!_parser.auStart)
-                        {
-                            _parser.auStart = _parser.head;
-                        }
-                        else
-                        {
-                            ACUfinish = true;
-                        }
-                    }
-                    else
-                    {
-                        if (hdr[4] & 0x80)
-                        {
-                            if (!_parser.auStart)
-                            {
-                                _parser.auStart = _parser.head;
-                            }
-                            else
-                            {
-                                ACUfinish = true;
-                            }
-                        }
-                    }
-                }
-            }
-
-            if (ACUfinish)
-            {
-                appendAccessUnit(_parser.auStart, _parser.head - _parser.auStart);
-                _parser.auStart = nullptr;
-                _parser.VCLcheck = false;
-            }
-
-            _parser.head += 4;
+            _parser.VCLcheck = false;
+            return false;
         }
-        else
+        break;
+    default:
+        return false;
+    }
+    //  a slice with first_mb_in_slice == 0 starts a new picture
+    BitReader reader(slice, sliceLen);
+    return reader.readUE() == 0 && !reader.overflow();
+}
+
+//  Payload arrives one slice at a time.  A NAL unit is matched by the five
+//  bytes 00 00 01 <nal header> <first slice byte>, which may span slices, so
+//  the last bytes seen are kept in a rolling window.  The window matches
+//  units completed within the first four bytes of a slice.  The rest are
+//  found by the findStartCode kernel.
+//  offset is the position of data within the stream's payload.
+void ElementaryStream::parseH264Stream(const uint8_t* data, size_t len,
+                                       size_t offset)
+{
+    uint64_t window = _parser.window;
+    size_t head = len < 4 ? len : 4;
+    for (size_t i = 0; i < head; ++i)
+    {
+        window = (window << 8) | data[i];
+        if (((window >> 16) & 0xffffff) == 0x000001)
         {
-            //  either outside or inside a NAL unit
-            ++_parser.head;                        
+            parseH264NalUnit((uint8_t)(window >> 8), (uint8_t)window,
+                             offset + i - 4);
         }
     }
+
+    auto findStartCode = cpu::kernels().findStartCode;
+    for (size_t i = findStartCode(data, 2, len);
+         i + 2 < len;
+         i = findStartCode(data, i + 1, len))
+    {
+        parseH264NalUnit(data[i+1], data[i+2], offset + i - 2);
+    }
+
+    //  eight bytes replace the window entirely
+    for (size_t i = len > 8 ? len - 8 : head; i < len; ++i)
+    {
+        window = (window << 8) | data[i];
+    }
+    _parser.window = window;
+}
+
+void ElementaryStream::parseH264NalUnit(uint8_t nalHeader, uint8_t sliceByte,
+                                        size_t start)
+{
+    if (!startsH264AccessUnit(nalHeader, &sliceByte, 1))
+        return;
+
+    if (_parser.auStarted)
+    {
+        const uint8_t* auData = _gather ? nullptr :
+            _buffer.head() + _parser.auStartOffset;
+        appendAccessUnit(auData, _parser.auStartOffset,
+                         start - _parser.auStartOffset);
+    }
+    _parser.auStartOffset = start;
+    _parser.auStarted = true;
 }
 
 
@@ -20,10 +20,12 @@ namespace cinekav {
 
     struct ESAccessUnit
     {
-        const uint8_t* data;
+        const uint8_t* data;        // null if the stream gathers payload
         size_t dataSize;
+        size_t offset;              // offset within the stream's payload
         uint64_t pts;
         uint64_t dts;
+        BlockPool::Block* block;    // set when the unit holds a reference
     };
     
     class ElementaryStream
@@ -39,6 +41,11 @@ namespace cinekav {
         ElementaryStream();
         ElementaryStream(Buffer&& buffer, Type type, uint16_t progId, uint8_t index,
                          const Memory& memory=Memory());
+        //  a stream that gathers payload by reference into a BufferChain
+        //  rather than copying it.  the demuxed input must outlive the
+        //  stream's access units.
+        ElementaryStream(Type type, uint16_t progId, uint8_t index,
+                         const Memory& memory=Memory());
         ElementaryStream(ElementaryStream&& other);
         ElementaryStream& operator=(ElementaryStream&& other);
 
@@ -51,8 +58,17 @@ namespace cinekav {
         uint8_t index() const { return _index; }
 
         const Buffer& buffer() const { return _buffer; }
+        bool gathered() const { return _gather; }
+        const BufferChain& chain() const { return _chain; }
     
+        //  returns the number of bytes that did not fit, in which case
+        //  nothing is appended.
         uint32_t appendPayload(Buffer& source, uint32_t len, bool pesStart);
+        uint32_t appendPayload(const uint8_t* data, uint32_t len, bool pesStart);
+        //  appends a run of payload slices with a single copy.  gathered
+        //  streams can only fail on allocation failure.
+        uint32_t appendPayload(const BufferSlice* slices, size_t count,
+                               bool pesStart);
         
     #if CINEK_AVLIB_IOSTREAMS
         std::basic_ostream<char>& write(std::basic_ostream<char>& ostr) const;
@@ -64,12 +80,21 @@ namespace cinekav {
 
         ESAccessUnit* accessUnit(size_t index);
         size_t accessUnitCount() const { return _ESAccessUnitCount; }
+        //  fills slices with the access unit's data, returning the number of
+        //  slices required.  contiguous streams always return one slice.
+        size_t gatherAccessUnit(const ESAccessUnit& au, BufferSlice* slices,
+                                size_t maxSlices) const;
+        //  bytes allocated for access unit tables and gathered slices.  the
+        //  stream's payload buffer is not included.
+        size_t memoryUsage() const;
         
     private:
         void freeESAUBatches();
 
         Memory _memory;
         Buffer _buffer;
+        BufferChain _chain;
+        bool _gather;
         Type _type;
         uint16_t _progId;
         uint8_t  _index;
@@ -101,18 +126,26 @@ namespace cinekav {
         //  access unit parsing state
         struct ESAccessUnitParserState
         {
-            const uint8_t* head;
-            const uint8_t* tail;
-            const uint8_t* auStart;
             bool VCLcheck;
+            //  payload is scanned one slice at a time as it is appended,
+            //  keeping the last bytes seen to match start codes across
+            //  slices.
+            uint64_t window;
+            size_t auStartOffset;
+            bool auStarted;
             ESAccessUnitParserState() :
-                head(nullptr), tail(nullptr), auStart(nullptr),
-                VCLcheck(false) {}
+                VCLcheck(false), window(~0ull), auStartOffset(0),
+                auStarted(false) {}
         };
         ESAccessUnitParserState _parser;
 
-        void appendAccessUnit(const uint8_t* data, size_t size);
-        void parseH264Stream();
+        void appendAccessUnit(const uint8_t* data, size_t offset, size_t size);
+        bool startsH264AccessUnit(uint8_t nalHeader, const uint8_t* slice,
+                                  size_t sliceLen);
+        void parseH264Stream(const uint8_t* data, size_t len, size_t offset);
+        //  start is the offset of the unit's start code
+        void parseH264NalUnit(uint8_t nalHeader, uint8_t sliceByte,
+                              size_t start);
     };
 
 }
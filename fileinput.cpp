@@ -0,0 +1,438 @@
+/**
+ *  @file       fileinput.cpp
+ *  @brief      File backed StreamInputCallbacks with network emulation
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#include "fileinput.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace cinekav {
+
+bool NetworkProfile::parseTrace(const char* text, size_t len)
+{
+    std::vector<Step> steps;
+    bool hasThroughput = false;
+    const char* end = text + len;
+    while (text < end)
+    {
+        const char* eol = (const char*)memchr(text, '\n', end - text);
+        if (!eol)
+            eol = end;
+        std::string line(text, eol);
+        text = eol + 1;
+
+        const char* p = line.c_str();
+        while (*p == ' ' || *p == '\t' || *p == '\r')
+            ++p;
+        if (!*p || *p == '#')
+            continue;
+
+        char* next;
+        double seconds = strtod(p, &next);
+        if (next == p || !(seconds > 0.0))
+            return false;
+        p = next;
+        double kbps = strtod(p, &next);
+        if (next == p || !(kbps >= 0.0))
+            return false;
+        for (p = next; *p; ++p)
+        {
+            if (*p != ' ' && *p != '\t' && *p != '\r')
+                return false;
+        }
+
+        Step step;
+        step.durationUs = (uint64_t)(seconds * 1000000.0 + 0.5);
+        step.bitsPerSecond = (uint64_t)(kbps * 1000.0 + 0.5);
+        if (!step.durationUs)
+            return false;
+        hasThroughput = hasThroughput || step.bitsPerSecond;
+        steps.push_back(step);
+    }
+    if (!hasThroughput)
+        return false;
+    trace.swap(steps);
+    return true;
+}
+
+NetworkEmulator::NetworkEmulator(const NetworkProfile& profile) :
+    _profile(profile),
+    _traceUs(0),
+    _traceBits(0),
+    _linkFreeUs(0),
+    _rnd(profile.seed ? profile.seed : 1)
+{
+    double bits = 0.0;
+    for (auto& step : _profile.trace)
+    {
+        _traceUs += step.durationUs;
+        bits += (double)step.durationUs * step.bitsPerSecond / 1000000.0;
+    }
+    _traceBits = (uint64_t)bits;
+    if (!_traceBits)
+        _profile.trace.clear();
+}
+
+//  xorshift64*
+uint32_t NetworkEmulator::random()
+{
+    _rnd ^= _rnd >> 12;
+    _rnd ^= _rnd << 25;
+    _rnd ^= _rnd >> 27;
+    return (uint32_t)((_rnd * 2685821657736338717ull) >> 32);
+}
+
+bool NetworkEmulator::chance(double probability)
+{
+    return probability > 0.0 && random() < probability * 4294967296.0;
+}
+
+uint64_t NetworkEmulator::scheduleOpen(uint64_t nowUs, bool* fail)
+{
+    uint64_t latencyUs = _profile.rttUs;
+    if (_profile.jitterUs)
+        latencyUs += random() % (_profile.jitterUs + 1);
+    *fail = chance(_profile.openFailureRate);
+    return nowUs + latencyUs;
+}
+
+uint64_t NetworkEmulator::scheduleRead(uint64_t nowUs, size_t bytes,
+                                       bool* fail)
+{
+    uint64_t startUs = nowUs > _linkFreeUs ? nowUs : _linkFreeUs;
+    _linkFreeUs = transferEnd(startUs, (uint64_t)bytes * 8);
+    *fail = chance(_profile.readFailureRate);
+    return _linkFreeUs;
+}
+
+uint64_t NetworkEmulator::transferEnd(uint64_t startUs, uint64_t bits) const
+{
+    if (_profile.trace.empty() || !bits)
+        return startUs;
+
+    //  whole passes through the trace send the same bits from any point,
+    //  leaving at most one pass to walk step by step.
+    uint64_t timeUs = startUs;
+    uint64_t passes = (bits - 1) / _traceBits;
+    timeUs += passes * _traceUs;
+    double remaining = (double)(bits - passes * _traceBits);
+
+    uint64_t phaseUs = timeUs % _traceUs;
+    size_t index = 0;
+    while (phaseUs >= _profile.trace[index].durationUs)
+    {
+        phaseUs -= _profile.trace[index].durationUs;
+        ++index;
+    }
+    for (;;)
+    {
+        const NetworkProfile::Step& step = _profile.trace[index];
+        uint64_t stepLeftUs = step.durationUs - phaseUs;
+        double stepBits = (double)stepLeftUs * step.bitsPerSecond / 1000000.0;
+        if (step.bitsPerSecond && stepBits >= remaining)
+        {
+            return timeUs + (uint64_t)std::ceil(remaining * 1000000.0 /
+                                                step.bitsPerSecond);
+        }
+        remaining -= stepBits;
+        timeUs += stepLeftUs;
+        phaseUs = 0;
+        if (++index == _profile.trace.size())
+            index = 0;
+    }
+}
+
+FileStreamInput::FileStreamInput
+(
+    const std::string& rootDir,
+    const NetworkProfile& profile
+) :
+    _rootDir(rootDir),
+    _network(profile),
+    _virtualClock(false),
+    _nextRequest(1),
+    _nextHandle(1),
+    _stop(false),
+    _stats()
+{
+    auto start = std::chrono::steady_clock::now();
+    _clock = [start]() -> uint64_t
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    };
+    if (!_rootDir.empty() && _rootDir.back() != '/')
+        _rootDir += '/';
+    _worker = std::thread(&FileStreamInput::runWorker, this);
+}
+
+FileStreamInput::~FileStreamInput()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _workCv.notify_one();
+    _worker.join();
+    for (auto& file : _files)
+        fclose(file.second.fp);
+}
+
+void FileStreamInput::setClock(ClockFn clock)
+{
+    _clock = std::move(clock);
+    _virtualClock = true;
+}
+
+uint64_t FileStreamInput::currentTimeUs() const
+{
+    return _clock();
+}
+
+StreamInputCallbacks FileStreamInput::callbacks()
+{
+    StreamInputCallbacks cbs;
+    cbs.openCb = [this](const char* url) { return open(url); };
+    cbs.sizeCb = [this](uintptr_t hnd) { return size(hnd); };
+    cbs.closeCb = [this](uintptr_t hnd) { close(hnd); };
+    cbs.readCb = [this](uintptr_t hnd, uint8_t* p, size_t cnt)
+    {
+        return read(hnd, p, cnt);
+    };
+    cbs.resultCb = [this](uint32_t request, uintptr_t* res)
+    {
+        return result(request, res);
+    };
+    cbs.timeCb = [this]() { return currentTimeUs(); };
+    return cbs;
+}
+
+auto FileStreamInput::stats() const -> Stats
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+std::string FileStreamInput::pathFromUrl(const char* url) const
+{
+    if (!strncmp(url, "file://", 7))
+    {
+        url += 7;
+        if (!strncmp(url, "localhost/", 10))
+            url += 9;
+        return std::string(url);
+    }
+    if (url[0] == '/')
+        return std::string(url);
+    return _rootDir + url;
+}
+
+uint32_t FileStreamInput::submit(Request&& request)
+{
+    uint32_t handle = _nextRequest++;
+    if (!_nextRequest)
+        _nextRequest = 1;
+    request.done = false;
+    request.error = false;
+    request.result = 0;
+    _requests[handle] = std::move(request);
+    _queue.push_back(handle);
+    _workCv.notify_one();
+    return handle;
+}
+
+uint32_t FileStreamInput::open(const char* url)
+{
+    Request request = Request();
+    request.type = kOpen;
+    request.path = pathFromUrl(url);
+    uint64_t nowUs = _clock();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    request.dueUs = _network.scheduleOpen(nowUs, &request.fail);
+    ++_stats.opens;
+    return submit(std::move(request));
+}
+
+uint32_t FileStreamInput::read(uintptr_t hnd, uint8_t* p, size_t cnt)
+{
+    uint64_t nowUs = _clock();
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _files.find(hnd);
+    if (it == _files.end())
+        return 0;
+
+    //  reads are clipped to the file so the emulated transfer is only as
+    //  long as the data delivered
+    File& file = it->second;
+    Request request = Request();
+    request.type = kRead;
+    request.hnd = hnd;
+    request.p = p;
+    request.cnt = std::min(cnt, file.size - file.pos);
+    request.offset = file.pos;
+    request.dueUs = _network.scheduleRead(nowUs, request.cnt, &request.fail);
+    if (!request.fail)
+        file.pos += request.cnt;
+    ++_stats.reads;
+    return submit(std::move(request));
+}
+
+size_t FileStreamInput::size(uintptr_t hnd)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _files.find(hnd);
+    return it != _files.end() ? it->second.size : 0;
+}
+
+void FileStreamInput::close(uintptr_t hnd)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_files.count(hnd))
+        return;
+
+    //  requests are handled in order, so once the close is done, so are all
+    //  reads on the file.  their results are no longer wanted.
+    Request request = Request();
+    request.type = kClose;
+    request.hnd = hnd;
+    uint32_t handle = submit(std::move(request));
+    _doneCv.wait(lock, [this, handle]() { return _requests[handle].done; });
+    for (auto it = _requests.begin(); it != _requests.end(); )
+    {
+        if (it->second.hnd == hnd && it->second.done)
+            it = _requests.erase(it);
+        else
+            ++it;
+    }
+}
+
+StreamInputCallbacks::Result FileStreamInput::result
+(
+    uint32_t request,
+    uintptr_t* res
+)
+{
+    uint64_t nowUs = _clock();
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _requests.find(request);
+    if (it == _requests.end())
+        return StreamInputCallbacks::Result::kInvalid;
+    if (nowUs < it->second.dueUs)
+        return StreamInputCallbacks::Result::kPending;
+    if (!it->second.done)
+    {
+        if (!_virtualClock)
+            return StreamInputCallbacks::Result::kPending;
+        //  the map may be rehashed by a submit, or the request erased by a
+        //  close, while the lock is released.  look it up again once done.
+        _doneCv.wait(lock, [this, request]()
+        {
+            auto found = _requests.find(request);
+            return found == _requests.end() || found->second.done;
+        });
+        it = _requests.find(request);
+        if (it == _requests.end())
+            return StreamInputCallbacks::Result::kInvalid;
+    }
+
+    bool error = it->second.error;
+    *res = it->second.result;
+    _requests.erase(it);
+    return error ? StreamInputCallbacks::Result::kError :
+                   StreamInputCallbacks::Result::kComplete;
+}
+
+void FileStreamInput::runWorker()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;)
+    {
+        _workCv.wait(lock, [this]() { return _stop || !_queue.empty(); });
+        if (_stop)
+            break;
+
+        uint32_t handle = _queue.front();
+        _queue.pop_front();
+        Request& request = _requests[handle];
+        FILE* fp = nullptr;
+        if (request.type != kOpen)
+        {
+            auto it = _files.find(request.hnd);
+            if (it != _files.end())
+                fp = it->second.fp;
+        }
+
+        //  files are only opened, read and closed here, outside the lock.
+        //  other threads don't touch a queued request.
+        lock.unlock();
+        bool ok = !request.fail;
+        size_t fileSize = 0;
+        if (request.type == kOpen && ok)
+        {
+            fp = fopen(request.path.c_str(), "rb");
+            ok = fp && !fseek(fp, 0, SEEK_END);
+            if (ok)
+            {
+                long end = ftell(fp);
+                ok = end >= 0 && !fseek(fp, 0, SEEK_SET);
+                fileSize = (size_t)end;
+            }
+            if (!ok && fp)
+            {
+                fclose(fp);
+                fp = nullptr;
+            }
+        }
+        else if (request.type == kRead && ok)
+        {
+            ok = fp && !fseek(fp, (long)request.offset, SEEK_SET) &&
+                 fread(request.p, 1, request.cnt, fp) == request.cnt;
+        }
+        else if (request.type == kClose && fp)
+        {
+            fclose(fp);
+        }
+        lock.lock();
+
+        if (request.type == kOpen)
+        {
+            if (ok)
+            {
+                uintptr_t hnd = _nextHandle++;
+                _files[hnd] = File { fp, fileSize, 0 };
+                request.result = hnd;
+            }
+            else
+                ++_stats.failedOpens;
+        }
+        else if (request.type == kRead)
+        {
+            if (ok)
+            {
+                request.result = request.cnt;
+                _stats.bytesRead += request.cnt;
+            }
+            else
+                ++_stats.failedReads;
+        }
+        else
+        {
+            _files.erase(request.hnd);
+        }
+        request.error = !ok;
+        request.done = true;
+        _doneCv.notify_all();
+    }
+}
+
+} /* namespace cinekav */
@@ -0,0 +1,175 @@
+/**
+ *  @file       fileinput.hpp
+ *  @brief      File backed StreamInputCallbacks with network emulation
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#ifndef CINEK_AVLIB_FILEINPUT_HPP
+#define CINEK_AVLIB_FILEINPUT_HPP
+
+#include "avstream.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace cinekav {
+
+//  Network conditions emulated by FileStreamInput
+struct NetworkProfile
+{
+    //  link throughput as a series of steps, repeated once the trace ends.
+    //  A step of 0 bps is an outage.  An empty trace, or one without any
+    //  throughput, is unlimited.
+    struct Step
+    {
+        uint64_t durationUs;
+        uint64_t bitsPerSecond;
+    };
+    std::vector<Step> trace;
+
+    uint32_t rttUs = 0;                 // latency of each open
+    uint32_t jitterUs = 0;              // adds up to this to each open
+    double openFailureRate = 0.0;       // fraction of opens that fail
+    double readFailureRate = 0.0;       // fraction of reads that fail
+    uint64_t seed = 1;
+
+    //  Parses a trace with one step per line: a duration in seconds and a
+    //  throughput in kbps.  Blank lines and lines starting with '#' are
+    //  ignored.  Returns false on a malformed line or a trace without
+    //  throughput.
+    bool parseTrace(const char* text, size_t len);
+};
+
+//  Schedules requests over a single emulated link.  Opens cost a round trip
+//  and don't occupy the link.  Reads transfer one at a time, each starting
+//  once the link is free.  Failures and jitter are drawn from a seeded
+//  generator in request order, so the same requests issued at the same
+//  times complete at the same times.
+class NetworkEmulator
+{
+public:
+    NetworkEmulator(const NetworkProfile& profile=NetworkProfile());
+
+    //  return the time a request issued at nowUs completes, and whether it
+    //  fails
+    uint64_t scheduleOpen(uint64_t nowUs, bool* fail);
+    uint64_t scheduleRead(uint64_t nowUs, size_t bytes, bool* fail);
+
+    const NetworkProfile& profile() const { return _profile; }
+
+private:
+    uint64_t transferEnd(uint64_t startUs, uint64_t bits) const;
+    uint32_t random();
+    bool chance(double probability);
+
+    NetworkProfile _profile;
+    uint64_t _traceUs;                  // trace length
+    uint64_t _traceBits;                // bits sent over the whole trace
+    uint64_t _linkFreeUs;
+    uint64_t _rnd;
+};
+
+//  Serves urls from the local filesystem, reading files on a worker thread.
+//  Urls are paths relative to a root directory, or file:// urls.  Requests
+//  complete once both the read has finished and the emulated network
+//  would have delivered it.
+//
+//  The emulated clock is by default the time since construction.  With a
+//  virtual clock, completion depends only on the clock, so playback is
+//  reproducible: a request that is due but still being read blocks resultCb
+//  until it finishes.
+//
+//  closeCb waits for reads into the caller's buffer to finish, so a stream
+//  may free its buffers once it has closed its input.
+class FileStreamInput
+{
+public:
+    using ClockFn = std::function<uint64_t()>;
+
+    FileStreamInput(const std::string& rootDir=std::string(),
+                    const NetworkProfile& profile=NetworkProfile());
+    ~FileStreamInput();
+
+    //  set before issuing requests
+    void setClock(ClockFn clock);
+    uint64_t currentTimeUs() const;
+
+    //  callbacks for a stream.  timeCb reports the emulated clock.
+    StreamInputCallbacks callbacks();
+
+    struct Stats
+    {
+        uint32_t opens;
+        uint32_t reads;
+        uint32_t failedOpens;           // including missing files
+        uint32_t failedReads;
+        uint64_t bytesRead;
+    };
+    Stats stats() const;
+
+private:
+    uint32_t open(const char* url);
+    uint32_t read(uintptr_t hnd, uint8_t* p, size_t cnt);
+    size_t size(uintptr_t hnd);
+    void close(uintptr_t hnd);
+    StreamInputCallbacks::Result result(uint32_t request, uintptr_t* result);
+
+    enum { kOpen, kRead, kClose };
+    struct Request
+    {
+        int type;
+        uintptr_t hnd;
+        std::string path;
+        uint8_t* p;
+        size_t cnt;
+        uint64_t offset;
+        uint64_t dueUs;
+        bool fail;                      // injected failure
+        bool done;
+        bool error;
+        uintptr_t result;
+    };
+    std::string pathFromUrl(const char* url) const;
+    //  queues a request for the worker, returning its handle.  call with
+    //  the mutex held.
+    uint32_t submit(Request&& request);
+    void runWorker();
+
+    struct File
+    {
+        FILE* fp;
+        size_t size;
+        size_t pos;                     // after the reads submitted
+    };
+
+    std::string _rootDir;
+    NetworkEmulator _network;
+    ClockFn _clock;
+    bool _virtualClock;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _workCv;
+    std::condition_variable _doneCv;
+    std::unordered_map<uint32_t, Request> _requests;
+    std::deque<uint32_t> _queue;
+    std::unordered_map<uintptr_t, File> _files;
+    uint32_t _nextRequest;
+    uintptr_t _nextHandle;
+    bool _stop;
+    Stats _stats;
+
+    std::thread _worker;
+};
+
+} /* namespace cinekav */
+
+#endif
@@ -9,22 +9,37 @@
 
 #include "hlsplaylist.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 namespace cinekav {
 
 
 HLSPlaylist::HLSPlaylist() :
     _seqNo(0),
-    _targetDuration(0.f),
-    _version(1)
+    _targetDuration(0),
+    _version(1),
+    _ended(false),
+    _canSkipUntilUs(0),
+    _durationUs(0),
+    _lastPrefix(kNoPrefix),
+    _unusedStrings(0)
 {
 }
 
 HLSPlaylist::HLSPlaylist(const std::string& uri, const Memory& memory) :
     _uri(uri),
     _seqNo(0),
-    _targetDuration(0.f),
+    _targetDuration(0),
     _version(1),
-    _segments(memory)
+    _ended(false),
+    _canSkipUntilUs(0),
+    _durationUs(0),
+    _segments(memory),
+    _strings(memory),
+    _prefixes(memory),
+    _lastPrefix(kNoPrefix),
+    _unusedStrings(0)
 {
 }
 
@@ -33,11 +48,23 @@ HLSPlaylist::HLSPlaylist(HLSPlaylist&& other) :
     _seqNo(other._seqNo),
     _targetDuration(other._targetDuration),
     _version(other._version),
-    _segments(std::move(other._segments))
+    _ended(other._ended),
+    _canSkipUntilUs(other._canSkipUntilUs),
+    _durationUs(other._durationUs),
+    _segments(std::move(other._segments)),
+    _strings(std::move(other._strings)),
+    _prefixes(std::move(other._prefixes)),
+    _lastPrefix(other._lastPrefix),
+    _unusedStrings(other._unusedStrings)
 {
     other._seqNo = 0;
-    other._targetDuration = 0.f;
+    other._targetDuration = 0;
     other._version = 1;
+    other._ended = false;
+    other._canSkipUntilUs = 0;
+    other._durationUs = 0;
+    other._lastPrefix = kNoPrefix;
+    other._unusedStrings = 0;
 }
 
 HLSPlaylist& HLSPlaylist::operator=(HLSPlaylist&& other)
@@ -46,16 +73,152 @@ HLSPlaylist& HLSPlaylist::operator=(HLSPlaylist&& other)
     _seqNo = other._seqNo;
     _targetDuration = other._targetDuration;
     _segments = std::move(other._segments);
+    _strings = std::move(other._strings);
+    _prefixes = std::move(other._prefixes);
+    _lastPrefix = other._lastPrefix;
+    _unusedStrings = other._unusedStrings;
     _version = other._version;
+    _ended = other._ended;
+    _canSkipUntilUs = other._canSkipUntilUs;
+    _durationUs = other._durationUs;
     other._seqNo = 0;
-    other._targetDuration = 0.f;
+    other._targetDuration = 0;
     other._version = 1;
+    other._ended = false;
+    other._canSkipUntilUs = 0;
+    other._durationUs = 0;
+    other._lastPrefix = kNoPrefix;
+    other._unusedStrings = 0;
     return *this;
 }
 
-void HLSPlaylist::addSegment(Segment&& segment)
+uint16_t HLSPlaylist::findOrAddPrefix(const char* prefix, size_t len)
+{
+    //  segments are almost always listed in runs sharing a path, so check
+    //  the most recently used prefix before searching the table.
+    if (_lastPrefix != kNoPrefix)
+    {
+        const Prefix& last = _prefixes[_lastPrefix];
+        if (last.length == len &&
+            !memcmp(_strings.data() + last.offset, prefix, len))
+        {
+            return _lastPrefix;
+        }
+    }
+    for (size_t i = 0; i < _prefixes.size(); ++i)
+    {
+        const Prefix& entry = _prefixes[i];
+        if (entry.length == len &&
+            !memcmp(_strings.data() + entry.offset, prefix, len))
+        {
+            _lastPrefix = (uint16_t)i;
+            return _lastPrefix;
+        }
+    }
+    if (_prefixes.size() >= kNoPrefix)
+        return kNoPrefix;
+
+    Prefix entry;
+    entry.offset = (uint32_t)_strings.size();
+    entry.length = (uint32_t)len;
+    _strings.insert(_strings.end(), prefix, prefix + len);
+    _prefixes.push_back(entry);
+    _lastPrefix = (uint16_t)(_prefixes.size()-1);
+    return _lastPrefix;
+}
+
+void HLSPlaylist::addSegment(const Segment& segment, const char* url,
+                             size_t urlLen)
+{
+    _segments.push_back(segment);
+    Segment& added = _segments.back();
+    _durationUs += segment.durationUs;
+
+    //  split the resolved url into its shared path and the segment specific
+    //  suffix
+    const char* suffix = url + urlLen;
+    while (suffix != url && *(suffix-1) != '/')
+        --suffix;
+
+    added.prefixIndex = kNoPrefix;
+    if (suffix != url)
+    {
+        added.prefixIndex = findOrAddPrefix(url, suffix - url);
+        if (added.prefixIndex == kNoPrefix)
+            suffix = url;
+    }
+    added.uriOffset = (uint32_t)_strings.size();
+    added.uriLength = (uint32_t)((url + urlLen) - suffix);
+    _strings.insert(_strings.end(), suffix, url + urlLen);
+}
+
+void HLSPlaylist::appendSegmentUrl(const Segment& segment,
+                                   std::string& out) const
 {
-    _segments.emplace_back(std::move(segment));
+    if (segment.prefixIndex != kNoPrefix)
+    {
+        const Prefix& prefix = _prefixes[segment.prefixIndex];
+        out.append(_strings.data() + prefix.offset, prefix.length);
+    }
+    out.append(_strings.data() + segment.uriOffset, segment.uriLength);
+}
+
+int HLSPlaylist::indexOfSequence(uint32_t seqNo) const
+{
+    //  sequence numbers are contiguous within a playlist
+    if (_segments.empty() || seqNo < _segments.front().seqNo)
+        return -1;
+    uint32_t index = seqNo - _segments.front().seqNo;
+    if (index >= _segments.size())
+        return -1;
+    return (int)index;
+}
+
+size_t HLSPlaylist::memoryUsage() const
+{
+    return _segments.capacity() * sizeof(Segment) + _strings.capacity() +
+           _prefixes.capacity() * sizeof(Prefix) + _uri.capacity();
+}
+
+void HLSPlaylist::trimFront(uint32_t seqNo)
+{
+    auto it = _segments.begin();
+    while (it != _segments.end() && it->seqNo < seqNo)
+    {
+        _durationUs -= it->durationUs;
+        _unusedStrings += it->uriLength;
+        ++it;
+    }
+    if (it == _segments.begin())
+        return;
+
+    _segments.erase(_segments.begin(), it);
+    if (_unusedStrings > _strings.size() / 2)
+    {
+        compactStrings();
+    }
+}
+
+void HLSPlaylist::compactStrings()
+{
+    std::vector<char, std_allocator<char>> strings(_strings.get_allocator());
+    strings.reserve(_strings.size() - _unusedStrings);
+    for (auto& prefix : _prefixes)
+    {
+        uint32_t offset = (uint32_t)strings.size();
+        strings.insert(strings.end(), _strings.begin() + prefix.offset,
+                       _strings.begin() + prefix.offset + prefix.length);
+        prefix.offset = offset;
+    }
+    for (auto& segment : _segments)
+    {
+        uint32_t offset = (uint32_t)strings.size();
+        strings.insert(strings.end(), _strings.begin() + segment.uriOffset,
+                       _strings.begin() + segment.uriOffset + segment.uriLength);
+        segment.uriOffset = offset;
+    }
+    _strings = std::move(strings);
+    _unusedStrings = 0;
 }
 
 auto HLSPlaylist::segmentAt(int index) -> Segment*
@@ -72,86 +235,501 @@ auto HLSPlaylist::segmentAt(int index) const -> const Segment*
 
 ////////////////////////////////////////////////////////////////////////////////
 
+//  Snapshot layout.  Every block is padded to kSnapshotAlign bytes so records
+//  within a snapshot at an aligned address (a mapped file) are aligned.
+//  Values are stored in host byte order, a byte swapped magic fails to load.
+//
+//  HLSPlaylist:        PlaylistSnapshotHeader, uri, Segment[], url prefix
+//                      table, url arena
+//  HLSMasterPlaylist:  MasterSnapshotHeader, then per stream a
+//                      StreamSnapshotRecord, its group strings and its
+//                      HLSPlaylist block
+//
+static const uint32_t kPlaylistSnapshotMagic = 0x4c504b43;  // 'CKPL'
+static const uint32_t kMasterSnapshotMagic = 0x504d4b43;    // 'CKMP'
+static const uint16_t kSnapshotVersion = 4;
+static const size_t kSnapshotAlign = 8;
+
+struct PlaylistSnapshotHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t playlistVersion;
+    uint32_t seqNo;
+    uint32_t targetDuration;
+    uint32_t segmentCount;
+    uint32_t prefixCount;
+    uint32_t stringsSize;
+    uint32_t uriLength;
+    uint64_t durationUs;
+    uint32_t canSkipUntilUs;
+    uint32_t flags;
+};
+
+static const uint32_t kPlaylistSnapshotEnded = 0x00000001;
+
+struct MasterSnapshotHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t streamCount;
+    uint32_t reserved2;
+};
+
+struct StreamSnapshotRecord
+{
+    uint32_t frameWidth;
+    uint32_t frameHeight;
+    uint32_t bandwidth;
+    uint32_t averageBandwidth;
+    uint32_t frameRate;
+    uint32_t codecMask;
+    uint32_t codecs[4];
+    uint32_t groupLengths[4];
+    uint8_t hdcpLevel;
+    uint8_t available;
+    uint16_t reserved;
+    uint32_t reserved2;
+};
+
+static_assert(sizeof(HLSPlaylist::Segment) == 32,
+              "Segment layout is part of the snapshot format");
+
+static size_t snapshotPad(size_t sz)
+{
+    return (sz + kSnapshotAlign-1) & ~(kSnapshotAlign-1);
+}
+
+static bool pushSnapshotData(Buffer& out, const void* data, size_t sz)
+{
+    size_t padded = snapshotPad(sz);
+    uint8_t* p = out.obtain((int)padded);
+    if (!p)
+        return false;
+    if (sz)
+        memcpy(p, data, sz);
+    memset(p + sz, 0, padded - sz);
+    return true;
+}
+
+static const uint8_t* pullSnapshotData(Buffer& in, size_t sz)
+{
+    size_t padded = snapshotPad(sz);
+    if ((size_t)in.size() < padded)
+        return nullptr;
+    const uint8_t* p = in.head();
+    in.skip(padded);
+    return p;
+}
+
+size_t HLSPlaylist::snapshotSize() const
+{
+    return snapshotPad(sizeof(PlaylistSnapshotHeader)) +
+           snapshotPad(_uri.size()) +
+           snapshotPad(_segments.size() * sizeof(Segment)) +
+           snapshotPad(_prefixes.size() * sizeof(Prefix)) +
+           snapshotPad(_strings.size());
+}
+
+bool HLSPlaylist::writeSnapshot(Buffer& out) const
+{
+    PlaylistSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kPlaylistSnapshotMagic;
+    header.version = kSnapshotVersion;
+    header.playlistVersion = (uint16_t)_version;
+    header.seqNo = _seqNo;
+    header.targetDuration = _targetDuration;
+    header.segmentCount = (uint32_t)_segments.size();
+    header.prefixCount = (uint32_t)_prefixes.size();
+    header.stringsSize = (uint32_t)_strings.size();
+    header.uriLength = (uint32_t)_uri.size();
+    header.durationUs = _durationUs;
+    header.canSkipUntilUs = _canSkipUntilUs;
+    header.flags = _ended ? kPlaylistSnapshotEnded : 0;
+
+    return pushSnapshotData(out, &header, sizeof(header)) &&
+           pushSnapshotData(out, _uri.data(), _uri.size()) &&
+           pushSnapshotData(out, _segments.data(),
+                            _segments.size() * sizeof(Segment)) &&
+           pushSnapshotData(out, _prefixes.data(),
+                            _prefixes.size() * sizeof(Prefix)) &&
+           pushSnapshotData(out, _strings.data(), _strings.size());
+}
+
+bool HLSPlaylist::readSnapshot(Buffer& in)
+{
+    auto p = pullSnapshotData(in, sizeof(PlaylistSnapshotHeader));
+    if (!p)
+        return false;
+    PlaylistSnapshotHeader header;
+    memcpy(&header, p, sizeof(header));
+    if (header.magic != kPlaylistSnapshotMagic ||
+        header.version != kSnapshotVersion)
+    {
+        return false;
+    }
+
+    const uint8_t* uri = pullSnapshotData(in, header.uriLength);
+    const uint8_t* segments = uri ? pullSnapshotData(in,
+        (size_t)header.segmentCount * sizeof(Segment)) : nullptr;
+    const uint8_t* prefixes = segments ? pullSnapshotData(in,
+        (size_t)header.prefixCount * sizeof(Prefix)) : nullptr;
+    const uint8_t* strings = prefixes ? pullSnapshotData(in,
+        header.stringsSize) : nullptr;
+    if (!strings || header.prefixCount > kNoPrefix)
+        return false;
+
+    //  verify every url part lies within the arena
+    for (uint32_t i = 0; i < header.prefixCount; ++i)
+    {
+        Prefix prefix;
+        memcpy(&prefix, prefixes + i * sizeof(Prefix), sizeof(prefix));
+        if ((uint64_t)prefix.offset + prefix.length > header.stringsSize)
+            return false;
+    }
+    for (uint32_t i = 0; i < header.segmentCount; ++i)
+    {
+        Segment segment;
+        memcpy(&segment, segments + i * sizeof(Segment), sizeof(segment));
+        uint64_t end = (uint64_t)segment.uriOffset + segment.uriLength;
+        if (end > header.stringsSize ||
+            (segment.prefixIndex != kNoPrefix &&
+             segment.prefixIndex >= header.prefixCount))
+        {
+            return false;
+        }
+    }
+
+    _uri.assign(reinterpret_cast<const char*>(uri), header.uriLength);
+    _seqNo = header.seqNo;
+    _targetDuration = header.targetDuration;
+    _version = header.playlistVersion;
+    _durationUs = header.durationUs;
+    _canSkipUntilUs = header.canSkipUntilUs;
+    _ended = (header.flags & kPlaylistSnapshotEnded) != 0;
+    _segments.resize(header.segmentCount);
+    if (header.segmentCount)
+        memcpy(_segments.data(), segments, header.segmentCount * sizeof(Segment));
+    _prefixes.resize(header.prefixCount);
+    if (header.prefixCount)
+        memcpy(_prefixes.data(), prefixes, header.prefixCount * sizeof(Prefix));
+    _lastPrefix = kNoPrefix;
+    _strings.assign(strings, strings + header.stringsSize);
+    _unusedStrings = 0;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//  Line parsing helpers.  All operate on [first, last) ranges within the
+//  source buffer so that no temporary strings are allocated per line.
+
+static bool isSpace(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+static void trimRange(const char*& first, const char*& last)
+{
+    while (first != last && isSpace(*first))
+        ++first;
+    while (last != first && isSpace(*(last-1)))
+        --last;
+}
+
+static const char* findChar(const char* first, const char* last, char ch)
+{
+    while (first != last && *first != ch)
+        ++first;
+    return first;
+}
+
+static bool equalsTag(const char* first, const char* last, const char* tag)
+{
+    while (first != last && *tag)
+    {
+        if (*first != *tag)
+            return false;
+        ++first;
+        ++tag;
+    }
+    return first == last && !*tag;
+}
+
+//  Numeric parsing.  Playlist numbers are unsigned decimal-integers or
+//  decimal-floating-points, so they are parsed directly from the line
+//  without allocation or dependence on the C locale.  Parsing stops at the
+//  first character that is not part of the number.
+
+static uint64_t parseDecimal(const char* first, const char* last)
+{
+    uint64_t v = 0;
+    for (; first != last; ++first)
+    {
+        unsigned digit = (unsigned)(*first - '0');
+        if (digit > 9)
+            break;
+        v = v*10 + digit;
+    }
+    return v;
+}
+
+static uint32_t parseInt(const char* first, const char* last)
+{
+    return (uint32_t)parseDecimal(first, last);
+}
+
+//  parses a decimal-floating-point into a fixed point integer with fracDigits
+//  digits after the decimal point, i.e. "9.009" with 6 digits is 9009000.
+//  any further digits are rounded.
+static uint64_t parseFixedPoint(const char* first, const char* last,
+                                int fracDigits)
+{
+    uint64_t v = 0;
+    for (; first != last; ++first)
+    {
+        unsigned digit = (unsigned)(*first - '0');
+        if (digit > 9)
+            break;
+        v = v*10 + digit;
+    }
+    int digits = 0;
+    bool roundUp = false;
+    if (first != last && *first == '.')
+    {
+        for (++first; first != last; ++first)
+        {
+            unsigned digit = (unsigned)(*first - '0');
+            if (digit > 9)
+                break;
+            if (digits == fracDigits)
+            {
+                roundUp = digit >= 5;
+                break;
+            }
+            v = v*10 + digit;
+            ++digits;
+        }
+    }
+    for (; digits < fracDigits; ++digits)
+    {
+        v *= 10;
+    }
+    return roundUp ? v+1 : v;
+}
+
+//  durations are held in 32 bits of microseconds, so longer ones (over about
+//  71.5 minutes) are clamped rather than wrapped
+static uint32_t parseDurationUs(const char* first, const char* last)
+{
+    uint64_t us = parseFixedPoint(first, last, 6);
+    return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static uint32_t parseHex(const char* first, const char* last)
+{
+    uint32_t v = 0;
+    for (; first != last; ++first)
+    {
+        char ch = *first;
+        if (ch >= '0' && ch <= '9')
+            v = (v << 4) | (ch - '0');
+        else if (ch >= 'a' && ch <= 'f')
+            v = (v << 4) | (ch - 'a' + 10);
+        else if (ch >= 'A' && ch <= 'F')
+            v = (v << 4) | (ch - 'A' + 10);
+        else
+            break;
+    }
+    return v;
+}
+
+//  Iterates an attribute list of the form NAME=VALUE[,NAME=VALUE...], where a
+//  VALUE may be a quoted string containing commas.  Quotes are stripped from
+//  the value passed to attrFn.
+template<typename AttrFn>
+static void parseAttributeList(const char* first, const char* last,
+                               AttrFn attrFn)
+{
+    while (first < last)
+    {
+        const char* delim = findChar(first, last, '=');
+        if (delim == last)
+            break;
+        const char* nameFirst = first;
+        const char* nameLast = delim;
+        const char* valueFirst = delim+1;
+        const char* valueLast;
+        if (valueFirst != last && *valueFirst == '"')
+        {
+            ++valueFirst;
+            valueLast = findChar(valueFirst, last, '"');
+            delim = (valueLast != last) ? findChar(valueLast+1, last, ',') : last;
+        }
+        else
+        {
+            valueLast = findChar(valueFirst, last, ',');
+            delim = valueLast;
+        }
+        trimRange(nameFirst, nameLast);
+        attrFn(nameFirst, nameLast, valueFirst, valueLast);
+        first = (delim == last) ? last : delim+1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 HLSPlaylistParser::HLSPlaylistParser() :
     _state(kInit),
-    _info()
+    _info(),
+    _nextByteOffset(0),
+    _nextSeqNo(0),
+    _updating(false),
+    _lastSeqNo(0),
+    _skipMismatch(false)
+{
+}
+
+bool HLSPlaylistParser::feed(HLSPlaylist& playlist, const char* data,
+                             size_t len)
 {
+    _lines.feed(data, len, [this, &playlist](const char* line, size_t lineLen) {
+        parse(playlist, line, lineLen);
+    });
+    return true;
+}
+
+bool HLSPlaylistParser::finish(HLSPlaylist& playlist)
+{
+    _lines.finish([this, &playlist](const char* line, size_t lineLen) {
+        parse(playlist, line, lineLen);
+    });
+    return true;
 }
 
-bool HLSPlaylistParser::parse(HLSPlaylist& playlist, const std::string& line)
+bool HLSPlaylistParser::parse(HLSPlaylist& playlist, const char* line,
+                              size_t len)
 {
     //  parse the trimmed version
-    auto fpos = line.find_first_not_of(" \r\n\t");
-    auto lpos = line.find_last_not_of(" \r\n\t");
-    if (fpos == std::string::npos || lpos == std::string::npos)
+    const char* first = line;
+    const char* last = line + len;
+    trimRange(first, last);
+    if (first == last)
         return true;
-    std::string trimmed = line.substr(fpos, (lpos - fpos)+1);
-    
+
     switch (_state)
     {
     case kInit:
-        if (trimmed == "#EXTM3U")
+        if (equalsTag(first, last, "#EXTM3U"))
         {
+            _updating = playlist.segmentCount() > 0;
+            if (_updating)
+            {
+                _lastSeqNo = playlist._segments.back().seqNo;
+            }
+            _nextSeqNo = playlist._seqNo;
             _state = kInputLine;
         }
         break;
     case kInputLine:
         {
-            if (trimmed[0]=='#')
+            if (*first=='#')
             {
-                auto paramSize = trimmed.find_first_of(':');
-                if (paramSize != std::string::npos)
+                if (equalsTag(first, last, "#EXT-X-ENDLIST"))
                 {
-                    auto valuePos = paramSize+1;
-                    auto valueSize = valuePos;
-                    valueSize = (trimmed.size() > valuePos) ? (trimmed.size() - valuePos)+1 :
-                                std::string::npos;
-                    if (valueSize > 0)
+                    playlist._ended = true;
+                    break;
+                }
+                const char* param = findChar(first, last, ':');
+                if (param != last)
+                {
+                    const char* value = param+1;
+                    if (value != last)
                     {
-                        if (trimmed.compare(0, paramSize, "#EXT-X-VERSION")==0)
+                        if (equalsTag(first, param, "#EXT-X-VERSION"))
                         {
                             if (playlist._version == 1)
                             {
-                                playlist._version =
-                                    std::stoi(trimmed.substr(valuePos, valueSize));
+                                playlist._version = parseInt(value, last);
                             }
                             else
                             {
                                 //  warn?
                             }
                         }
-                        else if (trimmed.compare(0, paramSize, "#EXT-X-TARGETDURATION")==0)
+                        else if (equalsTag(first, param, "#EXT-X-TARGETDURATION"))
                         {
-                            playlist._targetDuration = 
-                                std::stof(trimmed.substr(valuePos, valueSize));
+                            playlist._targetDuration = parseInt(value, last);
+                        }
+                        else if (equalsTag(first, param, "#EXT-X-MEDIA-SEQUENCE"))
+                        {
+                            playlist._seqNo = parseInt(value, last);
+                            _nextSeqNo = playlist._seqNo;
+                            //  drop segments that have left the live window
+                            playlist.trimFront(playlist._seqNo);
+                        }
+                        else if (equalsTag(first, param, "#EXT-X-SKIP"))
+                        {
+                            //  delta update: the skipped segments are the
+                            //  oldest segments in the window, which must
+                            //  all be held already.
+                            parseAttributeList(value, last,
+                                [this](const char* name, const char* nameLast,
+                                       const char* attr, const char* attrLast)
+                                {
+                                    if (equalsTag(name, nameLast, "SKIPPED-SEGMENTS"))
+                                        _nextSeqNo += parseInt(attr, attrLast);
+                                });
+                            if (!_updating ||
+                                (uint64_t)_nextSeqNo > (uint64_t)_lastSeqNo + 1)
+                            {
+                                _skipMismatch = true;
+                            }
+                        }
+                        else if (equalsTag(first, param, "#EXT-X-SERVER-CONTROL"))
+                        {
+                            parseAttributeList(value, last,
+                                [&playlist](const char* name, const char* nameLast,
+                                            const char* attr, const char* attrLast)
+                                {
+                                    if (equalsTag(name, nameLast, "CAN-SKIP-UNTIL"))
+                                    {
+                                        playlist._canSkipUntilUs =
+                                            parseDurationUs(attr, attrLast);
+                                    }
+                                });
                         }
-                        else if (trimmed.compare(0, paramSize, "#EXT-X-MEDIA-SEQUENCE")==0)
+                        else if (equalsTag(first, param, "#EXT-X-BYTERANGE"))
                         {
-                            playlist._seqNo = 
-                                std::stoi(trimmed.substr(valuePos, valueSize));
+                            //  <n>[@<o>], where a missing offset continues
+                            //  from the end of the previous sub-range
+                            const char* at = findChar(value, last, '@');
+                            _info.byteLength = parseInt(value, at);
+                            if (at != last)
+                            {
+                                _nextByteOffset = parseDecimal(at+1, last);
+                            }
+                            _info.byteOffset = _nextByteOffset;
+                            _nextByteOffset += _info.byteLength;
                         }
-                        else if (trimmed.compare(0, paramSize, "#EXTINF")==0)
+                        else if (equalsTag(first, param, "#EXTINF"))
                         {
-                            auto delim = trimmed.find_first_of(',', valuePos);
-                            if (delim == std::string::npos)
+                            const char* delim = findChar(value, last, ',');
+                            if (delim == last)
                             {
                                 //  error! standard requires #EXTINF:<length>,"
                             }
                             else
                             {
-                                _info.duration = 
-                                    std::stof(trimmed.substr(valuePos, delim - valuePos));
+                                _info.durationUs =
+                                    parseDurationUs(value, delim);
 
-                                //  determine if our uri is on the same line
-                                //  or the next line.
-                                if (delim+1 >= trimmed.size())
-                                {
-                                    _state = kPlaylistLine;
-                                }
-                                else
-                                {
-                                    _info.uri = trimmed.substr(delim+1);
-                                }
+                                //  any text after the delimiter is an
+                                //  optional title.  the uri is always on the
+                                //  next line.
+                                _state = kPlaylistLine;
                             }
                         }
                     }
@@ -161,8 +739,18 @@ bool HLSPlaylistParser::parse(HLSPlaylist& playlist, const std::string& line)
         break;
     case kPlaylistLine:
         {
-            _info.uri = trimmed;
-            playlist.addSegment(std::move(_info));
+            _info.seqNo = _nextSeqNo++;
+            //  segments already known from a previous load are kept as is.
+            //  new segment urls are resolved once here, against the
+            //  playlist's own url.  nothing is added past a skip gap, which
+            //  would break the contiguous sequence numbers.
+            if (!_skipMismatch && (!_updating || _info.seqNo > _lastSeqNo))
+            {
+                resolveUrl(_url, playlist._uri.data(), playlist._uri.size(),
+                           first, last - first);
+                playlist.addSegment(_info, _url.data(), _url.size());
+            }
+            _info = HLSPlaylist::Segment();
             _state = kInputLine;
         }
         break;
@@ -173,7 +761,11 @@ bool HLSPlaylistParser::parse(HLSPlaylist& playlist, const std::string& line)
 
 HLSMasterPlaylist::HLSMasterPlaylist(const Memory& memory) :
     _memory(memory),
-    _playlists(_memory)
+    _playlists(_memory),
+    _byBandwidth(_memory),
+    _byResolution(_memory),
+    _byCodecBandwidth(_memory),
+    _codecGroups(_memory)
 {
 }
 
@@ -183,106 +775,347 @@ auto HLSMasterPlaylist::addStream
     const std::string& uri
 ) -> StreamInfo*
 {
-    //  sort?  criterion?
     _playlists.emplace_back();
     _playlists.back().info = info;
     _playlists.back().playlist = HLSPlaylist(uri, _memory);
+    indexStream((uint16_t)(_playlists.size()-1));
     return &_playlists.back();
 }
 
-HLSMasterPlaylistParser::HLSMasterPlaylistParser() :
+size_t HLSMasterPlaylist::memoryUsage() const
+{
+    size_t usage = _playlists.capacity() * sizeof(StreamInfo) +
+                   (_byBandwidth.capacity() + _byResolution.capacity() +
+                    _byCodecBandwidth.capacity()) * sizeof(uint16_t) +
+                   _codecGroups.capacity() * sizeof(CodecGroup);
+    for (auto& stream : _playlists)
+    {
+        usage += stream.playlist.memoryUsage();
+    }
+    return usage;
+}
+
+auto HLSMasterPlaylist::streamAt(int index) -> StreamInfo*
+{
+    return const_cast<StreamInfo*>(static_cast<const HLSMasterPlaylist*>(this)->streamAt(index));
+}
+
+auto HLSMasterPlaylist::streamAt(int index) const -> const StreamInfo*
+{
+    if (index < 0 || (size_t)index >= _playlists.size())
+        return nullptr;
+    return &_playlists[index];
+}
+
+void HLSMasterPlaylist::indexStream(uint16_t index)
+{
+    const Playlists& playlists = _playlists;
+    auto bandwidthLess = [&playlists](uint16_t l, uint16_t r) -> bool {
+        return playlists[l].info.bandwidth < playlists[r].info.bandwidth;
+    };
+    auto resolutionLess = [&playlists](uint16_t l, uint16_t r) -> bool {
+        const PlaylistInfo& li = playlists[l].info;
+        const PlaylistInfo& ri = playlists[r].info;
+        return (uint64_t)li.frameWidth * li.frameHeight <
+               (uint64_t)ri.frameWidth * ri.frameHeight;
+    };
+    auto codecBandwidthLess = [&playlists](uint16_t l, uint16_t r) -> bool {
+        const PlaylistInfo& li = playlists[l].info;
+        const PlaylistInfo& ri = playlists[r].info;
+        if (li.codecMask != ri.codecMask)
+            return li.codecMask < ri.codecMask;
+        return li.bandwidth < ri.bandwidth;
+    };
+
+    _byBandwidth.insert(std::upper_bound(_byBandwidth.begin(),
+                                         _byBandwidth.end(),
+                                         index, bandwidthLess),
+                        index);
+    _byResolution.insert(std::upper_bound(_byResolution.begin(),
+                                          _byResolution.end(),
+                                          index, resolutionLess),
+                         index);
+    _byCodecBandwidth.insert(std::upper_bound(_byCodecBandwidth.begin(),
+                                              _byCodecBandwidth.end(),
+                                              index, codecBandwidthLess),
+                             index);
+
+    //  rebuild the codec group ranges - variant counts are small and this
+    //  only happens while parsing.
+    _codecGroups.clear();
+    for (uint16_t i = 0; i < _byCodecBandwidth.size(); ++i)
+    {
+        uint32_t mask = _playlists[_byCodecBandwidth[i]].info.codecMask;
+        if (_codecGroups.empty() || _codecGroups.back().codecMask != mask)
+        {
+            CodecGroup group;
+            group.codecMask = mask;
+            group.first = i;
+            group.last = i;
+            _codecGroups.push_back(group);
+        }
+        ++_codecGroups.back().last;
+    }
+}
+
+size_t HLSMasterPlaylist::snapshotSize() const
+{
+    size_t sz = snapshotPad(sizeof(MasterSnapshotHeader));
+    for (auto& stream : _playlists)
+    {
+        sz += snapshotPad(sizeof(StreamSnapshotRecord));
+        sz += snapshotPad(stream.info.audioGroup.size());
+        sz += snapshotPad(stream.info.videoGroup.size());
+        sz += snapshotPad(stream.info.subtitlesGroup.size());
+        sz += snapshotPad(stream.info.closedCaptions.size());
+        sz += stream.playlist.snapshotSize();
+    }
+    return sz;
+}
+
+bool HLSMasterPlaylist::writeSnapshot(Buffer& out) const
+{
+    MasterSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kMasterSnapshotMagic;
+    header.version = kSnapshotVersion;
+    header.streamCount = (uint32_t)_playlists.size();
+    if (!pushSnapshotData(out, &header, sizeof(header)))
+        return false;
+
+    for (auto& stream : _playlists)
+    {
+        const PlaylistInfo& info = stream.info;
+        StreamSnapshotRecord record;
+        memset(&record, 0, sizeof(record));
+        record.frameWidth = info.frameWidth;
+        record.frameHeight = info.frameHeight;
+        record.bandwidth = info.bandwidth;
+        record.averageBandwidth = info.averageBandwidth;
+        record.frameRate = info.frameRate;
+        record.codecMask = info.codecMask;
+        for (size_t i = 0; i < info.codecs.size(); ++i)
+            record.codecs[i] = info.codecs[i];
+        record.groupLengths[0] = (uint32_t)info.audioGroup.size();
+        record.groupLengths[1] = (uint32_t)info.videoGroup.size();
+        record.groupLengths[2] = (uint32_t)info.subtitlesGroup.size();
+        record.groupLengths[3] = (uint32_t)info.closedCaptions.size();
+        record.hdcpLevel = (uint8_t)info.hdcpLevel;
+        record.available = info.available ? 1 : 0;
+
+        if (!pushSnapshotData(out, &record, sizeof(record)) ||
+            !pushSnapshotData(out, info.audioGroup.data(), info.audioGroup.size()) ||
+            !pushSnapshotData(out, info.videoGroup.data(), info.videoGroup.size()) ||
+            !pushSnapshotData(out, info.subtitlesGroup.data(), info.subtitlesGroup.size()) ||
+            !pushSnapshotData(out, info.closedCaptions.data(), info.closedCaptions.size()) ||
+            !stream.playlist.writeSnapshot(out))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HLSMasterPlaylist::readSnapshot(Buffer& in)
+{
+    //  variants are loaded aside, so a truncated or corrupt snapshot leaves
+    //  this playlist as it was
+    HLSMasterPlaylist loaded(_memory);
+    auto p = pullSnapshotData(in, sizeof(MasterSnapshotHeader));
+    if (!p)
+        return false;
+    MasterSnapshotHeader header;
+    memcpy(&header, p, sizeof(header));
+    if (header.magic != kMasterSnapshotMagic ||
+        header.version != kSnapshotVersion)
+    {
+        return false;
+    }
+
+    loaded._playlists.reserve(header.streamCount);
+    for (uint32_t streamIdx = 0; streamIdx < header.streamCount; ++streamIdx)
+    {
+        p = pullSnapshotData(in, sizeof(StreamSnapshotRecord));
+        if (!p)
+            return false;
+        StreamSnapshotRecord record;
+        memcpy(&record, p, sizeof(record));
+
+        PlaylistInfo info;
+        info.frameWidth = record.frameWidth;
+        info.frameHeight = record.frameHeight;
+        info.bandwidth = record.bandwidth;
+        info.averageBandwidth = record.averageBandwidth;
+        info.frameRate = record.frameRate;
+        info.codecMask = record.codecMask;
+        for (size_t i = 0; i < info.codecs.size(); ++i)
+            info.codecs[i] = record.codecs[i];
+        info.hdcpLevel = (HDCPLevel)record.hdcpLevel;
+        info.available = record.available != 0;
+
+        std::string* groups[4] = {
+            &info.audioGroup, &info.videoGroup,
+            &info.subtitlesGroup, &info.closedCaptions
+        };
+        for (int i = 0; i < 4; ++i)
+        {
+            p = pullSnapshotData(in, record.groupLengths[i]);
+            if (!p)
+                return false;
+            groups[i]->assign(reinterpret_cast<const char*>(p),
+                              record.groupLengths[i]);
+        }
+
+        StreamInfo* stream = loaded.addStream(info, std::string());
+        if (!stream->playlist.readSnapshot(in))
+            return false;
+    }
+    *this = std::move(loaded);
+    return true;
+}
+
+int HLSMasterPlaylist::selectByBandwidth
+(
+    uint32_t maxBandwidth,
+    uint32_t familyMask
+) const
+{
+    int best = -1;
+    for (auto& group : _codecGroups)
+    {
+        if (group.codecMask & ~familyMask)
+            continue;
+        auto first = _byCodecBandwidth.begin() + group.first;
+        auto it = std::upper_bound(first,
+            _byCodecBandwidth.begin() + group.last,
+            maxBandwidth,
+            [this](uint32_t bw, uint16_t r) -> bool {
+                return bw < _playlists[r].info.bandwidth;
+            });
+        while (it != first)
+        {
+            --it;
+            const PlaylistInfo& info = _playlists[*it].info;
+            if (!info.available)
+                continue;
+            if (best < 0 || _playlists[best].info.bandwidth < info.bandwidth)
+                best = *it;
+            break;
+        }
+    }
+    return best;
+}
+
+int HLSMasterPlaylist::selectLowestBandwidth(uint32_t familyMask) const
+{
+    for (auto index : _byBandwidth)
+    {
+        const PlaylistInfo& info = _playlists[index].info;
+        if (info.available && info.decodable(familyMask))
+            return index;
+    }
+    return -1;
+}
+
+int HLSMasterPlaylist::selectByResolution
+(
+    uint32_t maxWidth,
+    uint32_t maxHeight,
+    uint32_t familyMask
+) const
+{
+    uint64_t maxPixels = (uint64_t)maxWidth * maxHeight;
+    auto it = std::upper_bound(_byResolution.begin(), _byResolution.end(),
+        maxPixels,
+        [this](uint64_t pixels, uint16_t r) -> bool {
+            const PlaylistInfo& info = _playlists[r].info;
+            return pixels < (uint64_t)info.frameWidth * info.frameHeight;
+        });
+    while (it != _byResolution.begin())
+    {
+        --it;
+        const PlaylistInfo& info = _playlists[*it].info;
+        if (info.available && info.decodable(familyMask) &&
+            info.frameWidth <= maxWidth && info.frameHeight <= maxHeight)
+        {
+            return *it;
+        }
+    }
+    return -1;
+}
+
+HLSMasterPlaylistParser::HLSMasterPlaylistParser(const std::string& baseUrl) :
     _state(kInit),
-    _version(1)
+    _version(1),
+    _baseUrl(baseUrl)
+{
+}
+
+bool HLSMasterPlaylistParser::feed(HLSMasterPlaylist& playlist,
+                                   const char* data, size_t len)
+{
+    _lines.feed(data, len, [this, &playlist](const char* line, size_t lineLen) {
+        parse(playlist, line, lineLen);
+    });
+    return true;
+}
+
+bool HLSMasterPlaylistParser::finish(HLSMasterPlaylist& playlist)
 {
+    _lines.finish([this, &playlist](const char* line, size_t lineLen) {
+        parse(playlist, line, lineLen);
+    });
+    return true;
 }
 
 bool HLSMasterPlaylistParser::parse(HLSMasterPlaylist& playlist,
-                                    const std::string& line)
+                                    const char* line, size_t len)
 {
     //  parse the trimmed version
-    auto fpos = line.find_first_not_of(" \r\n\t");
-    auto lpos = line.find_last_not_of(" \r\n\t");
-    if (fpos == std::string::npos || lpos == std::string::npos)
+    const char* first = line;
+    const char* last = line + len;
+    trimRange(first, last);
+    if (first == last)
         return true;
-    std::string trimmed = line.substr(fpos, (lpos - fpos)+1);
-    
+
     switch (_state)
     {
     case kInit:
-        if (trimmed == "#EXTM3U")
+        if (equalsTag(first, last, "#EXTM3U"))
         {
             _state = kInputLine;
         }
         break;
     case kInputLine:
         {
-            if (trimmed[0]=='#')
+            if (*first=='#')
             {
-                auto paramSize = trimmed.find_first_of(':');
-                if (paramSize != std::string::npos)
+                const char* param = findChar(first, last, ':');
+                if (param != last)
                 {
-                    auto valuePos = paramSize+1;
-                    auto valueSize = valuePos;
-                    valueSize = (trimmed.size() > valuePos) ? (trimmed.size() - valuePos)+1 :
-                                std::string::npos;
-                    if (valueSize > 0)
+                    const char* value = param+1;
+                    if (value != last)
                     {
-                        if (trimmed.compare(0, paramSize, "#EXT-X-VERSION")==0)
+                        if (equalsTag(first, param, "#EXT-X-VERSION"))
                         {
                             if (_version == 1)
                             {
-                                _version = std::stoi(trimmed.substr(valuePos, valueSize));
+                                _version = parseInt(value, last);
                             }
                             else
                             {
                                 //  warn?
                             }
                         }
-                        else if (trimmed.compare(0, paramSize, "#EXT-X-STREAM-INF")==0)
+                        else if (equalsTag(first, param, "#EXT-X-STREAM-INF"))
                         {
-                            //  parse the info line, note that many times our
-                            //  valuePos will be std::string::npos+1, so
-                            //  we add a >0 check to rule out valuePos rolling
-                            //  over to 0.  valuePos would always start the loop
-                            //  > 0, so this 'hackish' method should work. 
-                            while (valuePos < trimmed.size() && valuePos > 0)
-                            {
-                                auto delimPos = trimmed.find_first_of('=', valuePos);
-                                std::string field = trimmed.substr(valuePos, delimPos - valuePos);
-                                valuePos = delimPos+1;
-                                delimPos = trimmed.find_first_of("\",", valuePos);
-                                if (trimmed[delimPos]=='"')
-                                {
-                                    ++delimPos;
-                                    //  retrieve quoted string
-                                    delimPos = trimmed.find_first_of('"', delimPos);
-                                    ++delimPos;
-                                }
-                                std::string value = trimmed.substr(valuePos, delimPos - valuePos);
-                                valuePos = delimPos+1;
-
-                                if (field == "BANDWIDTH")
+                            parseAttributeList(value, last,
+                                [this](const char* name, const char* nameLast,
+                                       const char* attr, const char* attrLast)
                                 {
-                                    _info.bandwidth = std::stoi(value);
-                                }
-                                else if (field == "RESOLUTION")
-                                {
-                                    auto xPos = value.find_first_of('x');
-                                    if (xPos != std::string::npos)
-                                    {
-                                        _info.frameWidth = std::stoi(value.substr(0, xPos));
-                                        _info.frameHeight = std::stoi(value.substr(xPos+1));
-                                    }
-                                    else
-                                    {
-                                        //  warn?
-                                    }
-                                }
-                                else if (field == "CODECS")
-                                {
-                                    parseCodecs(value);
-                                }
-                            }
+                                    parseStreamAttribute(name, nameLast - name,
+                                                         attr, attrLast - attr);
+                                });
                             //  next line will contain the uri for the playlist
                             _state = kPlaylistLine;
                         }
@@ -293,7 +1126,10 @@ bool HLSMasterPlaylistParser::parse(HLSMasterPlaylist& playlist,
         break;
     case kPlaylistLine:
         {
-            playlist.addStream(_info, trimmed);
+            resolveUrl(_url, _baseUrl.data(), _baseUrl.size(),
+                       first, last - first);
+            playlist.addStream(_info, _url);
+            _info = HLSMasterPlaylist::PlaylistInfo();
             _state = kInputLine;
         }
         break;
@@ -302,22 +1138,207 @@ bool HLSMasterPlaylistParser::parse(HLSMasterPlaylist& playlist,
     return true;
 }
 
-void HLSMasterPlaylistParser::parseCodecs(const std::string& line)
+void HLSMasterPlaylistParser::parseStreamAttribute
+(
+    const char* name, size_t nameLen,
+    const char* value, size_t valueLen
+)
+{
+    const char* nameLast = name + nameLen;
+    const char* valueLast = value + valueLen;
+
+    if (equalsTag(name, nameLast, "BANDWIDTH"))
+    {
+        _info.bandwidth = parseInt(value, valueLast);
+    }
+    else if (equalsTag(name, nameLast, "AVERAGE-BANDWIDTH"))
+    {
+        _info.averageBandwidth = parseInt(value, valueLast);
+    }
+    else if (equalsTag(name, nameLast, "RESOLUTION"))
+    {
+        const char* xPos = findChar(value, valueLast, 'x');
+        if (xPos != valueLast)
+        {
+            _info.frameWidth = parseInt(value, xPos);
+            _info.frameHeight = parseInt(xPos+1, valueLast);
+        }
+        else
+        {
+            //  warn?
+        }
+    }
+    else if (equalsTag(name, nameLast, "FRAME-RATE"))
+    {
+        _info.frameRate = (uint32_t)parseFixedPoint(value, valueLast, 3);
+    }
+    else if (equalsTag(name, nameLast, "CODECS"))
+    {
+        parseCodecs(value, valueLen);
+    }
+    else if (equalsTag(name, nameLast, "AUDIO"))
+    {
+        _info.audioGroup.assign(value, valueLast);
+    }
+    else if (equalsTag(name, nameLast, "VIDEO"))
+    {
+        _info.videoGroup.assign(value, valueLast);
+    }
+    else if (equalsTag(name, nameLast, "SUBTITLES"))
+    {
+        _info.subtitlesGroup.assign(value, valueLast);
+    }
+    else if (equalsTag(name, nameLast, "CLOSED-CAPTIONS"))
+    {
+        _info.closedCaptions.assign(value, valueLast);
+    }
+    else if (equalsTag(name, nameLast, "HDCP-LEVEL"))
+    {
+        if (equalsTag(value, valueLast, "TYPE-0"))
+            _info.hdcpLevel = HLSMasterPlaylist::kHDCP_Type0;
+        else if (equalsTag(value, valueLast, "TYPE-1"))
+            _info.hdcpLevel = HLSMasterPlaylist::kHDCP_Type1;
+        else
+            _info.hdcpLevel = HLSMasterPlaylist::kHDCP_None;
+    }
+}
+
+void HLSMasterPlaylistParser::parseCodecs(const char* str, size_t len)
 {
-    //  todo as needed
-    /*
-    std::string::size_type lPos = 0;
-    while (lPos < line.length())
+    const char* last = str + len;
+    size_t codecIndex = 0;
+    while (str < last)
     {
-        auto rPos = line.find_first_of(',', lPos);
-        if (rPos == std::string::npos)
-            rPos = line.length();
-        std::string codec = line.substr(lPos, rPos - lPos);
-        //  parse codec line into our uint32_t
+        const char* delim = findChar(str, last, ',');
+        const char* codecFirst = str;
+        const char* codecLast = delim;
+        trimRange(codecFirst, codecLast);
+        if (codecFirst != codecLast)
+        {
+            uint32_t codec = HLSMasterPlaylist::parseCodec(codecFirst,
+                                                        codecLast - codecFirst);
+            _info.codecMask |= HLSMasterPlaylist::codecFamilyBit(
+                HLSMasterPlaylist::codecFamily(codec));
+            if (codecIndex < _info.codecs.size())
+            {
+                _info.codecs[codecIndex++] = codec;
+            }
+        }
+        str = delim+1;
+    }
+}
 
-        lPos = rPos+1;
+uint32_t HLSMasterPlaylist::parseCodec(const char* str, size_t len)
+{
+    const char* last = str + len;
+    const char* fourcc = str;
+    const char* field = findChar(str, last, '.');
+    const char* fourccLast = field;
+    const char* fields[3] = { last, last, last };
+    const char* fieldsLast[3] = { last, last, last };
+    for (int i = 0; i < 3 && field != last; ++i)
+    {
+        fields[i] = field+1;
+        field = findChar(fields[i], last, '.');
+        fieldsLast[i] = field;
+    }
+
+    if (equalsTag(fourcc, fourccLast, "avc1") ||
+        equalsTag(fourcc, fourccLast, "avc3"))
+    {
+        //  avc1.PPCCLL (hex profile_idc, constraint flags, level_idc), or
+        //  the legacy avc1.<profile>.<level> decimal form.
+        if (fieldsLast[0] - fields[0] == 6 && fields[1] == last)
+        {
+            uint32_t v = parseHex(fields[0], fieldsLast[0]);
+            return packCodec(codecs::kFamily_AVC, (v >> 16) & 0xff,
+                             (v >> 8) & 0xff, v & 0xff);
+        }
+        return packCodec(codecs::kFamily_AVC,
+                         parseInt(fields[0], fieldsLast[0]), 0,
+                         parseInt(fields[1], fieldsLast[1]));
+    }
+    else if (equalsTag(fourcc, fourccLast, "hvc1") ||
+             equalsTag(fourcc, fourccLast, "hev1"))
+    {
+        //  hvc1.[A-C]<profile_idc>.<compat flags>.<L|H><level_idc>...
+        const char* profile = fields[0];
+        if (profile != fieldsLast[0] && *profile >= 'A' && *profile <= 'C')
+            ++profile;
+        const char* tier = fields[2];
+        uint8_t highTier = 0;
+        if (tier != fieldsLast[2] && (*tier == 'L' || *tier == 'H'))
+        {
+            highTier = *tier == 'H' ? 1 : 0;
+            ++tier;
+        }
+        return packCodec(codecs::kFamily_HEVC, parseInt(profile, fieldsLast[0]),
+                         highTier, parseInt(tier, fieldsLast[2]));
+    }
+    else if (equalsTag(fourcc, fourccLast, "vp09"))
+    {
+        //  vp09.<profile>.<level>.<bitdepth>...
+        return packCodec(codecs::kFamily_VP9,
+                         parseInt(fields[0], fieldsLast[0]), 0,
+                         parseInt(fields[1], fieldsLast[1]));
+    }
+    else if (equalsTag(fourcc, fourccLast, "av01"))
+    {
+        //  av01.<profile>.<level><M|H>.<bitdepth>...
+        const char* tier = fieldsLast[1];
+        uint8_t highTier = 0;
+        if (tier != fields[1] && (*(tier-1) == 'H' || *(tier-1) == 'M'))
+        {
+            --tier;
+            highTier = *tier == 'H' ? 1 : 0;
+        }
+        return packCodec(codecs::kFamily_AV1,
+                         parseInt(fields[0], fieldsLast[0]),
+                         highTier, parseInt(fields[1], tier));
     }
-    */
+    else if (equalsTag(fourcc, fourccLast, "mp4a"))
+    {
+        //  mp4a.<hex objectTypeIndication>[.<decimal audio object type>]
+        uint32_t oti = parseHex(fields[0], fieldsLast[0]);
+        uint32_t aot = parseInt(fields[1], fieldsLast[1]);
+        if (oti == 0x40 || oti == 0x66 || oti == 0x67 || oti == 0x68)
+        {
+            //  MPEG-4 audio object type 34 is MPEG-1/2 Layer 3
+            if (aot == 34)
+                return packCodec(codecs::kFamily_MPEG1Audio, 0, oti, 0);
+            return packCodec(codecs::kFamily_AAC, aot, oti, 0);
+        }
+        else if (oti == 0x69)
+        {
+            return packCodec(codecs::kFamily_MPEG2Audio, 0, oti, 0);
+        }
+        else if (oti == 0x6b)
+        {
+            return packCodec(codecs::kFamily_MPEG1Audio, 0, oti, 0);
+        }
+        else if (oti == 0xa5)
+        {
+            return packCodec(codecs::kFamily_AC3, 0, oti, 0);
+        }
+        else if (oti == 0xa6)
+        {
+            return packCodec(codecs::kFamily_EC3, 0, oti, 0);
+        }
+    }
+    else if (equalsTag(fourcc, fourccLast, "ac-3"))
+    {
+        return packCodec(codecs::kFamily_AC3, 0, 0, 0);
+    }
+    else if (equalsTag(fourcc, fourccLast, "ec-3"))
+    {
+        return packCodec(codecs::kFamily_EC3, 0, 0, 0);
+    }
+    else if (equalsTag(fourcc, fourccLast, "mp3"))
+    {
+        return packCodec(codecs::kFamily_MPEG1Audio, 0, 0, 0);
+    }
+
+    return packCodec(codecs::kFamily_None, 0, 0, 0);
 }
 
 
@@ -11,9 +11,11 @@
 #define CINEK_AVLIB_HLSPLAYLIST_HPP
 
 #include "avstream.hpp"
+#include "avcodecs.hpp"
 #include <array>
 #include <vector>
 #include <string>
+#include <cstring>
 
 namespace cinekav {
     namespace mpegts {
@@ -30,44 +32,142 @@ class HLSPlaylistParser;
 class HLSPlaylist
 {
 public:
+    //  A compact segment record.  The segment's url is resolved when the
+    //  playlist is parsed and stored within the playlist's string arena as
+    //  a shared prefix (the url up to and including its last '/') and a
+    //  per-segment suffix.
     struct Segment
     {
-        std::string uri;
-        float duration;
-        Segment() = default;
-        Segment(Segment&& other) : 
-            uri(std::move(other.uri)),
-            duration(other.duration)
-        {
-            other.duration = 0.f;
-        }
-        Segment& operator=(Segment&& other)
-        {
-            uri = std::move(other.uri);
-            duration = other.duration;
-            other.duration = 0.f;
-            return *this;
-        }
+        uint64_t byteOffset;        // EXT-X-BYTERANGE offset
+        uint32_t byteLength;        // EXT-X-BYTERANGE length, 0 = entire uri
+        uint32_t uriOffset;         // suffix offset within the arena
+        uint32_t uriLength;         // suffix length
+        uint32_t seqNo;             // media sequence number
+        uint32_t durationUs;        // microseconds, at most UINT32_MAX
+        uint16_t prefixIndex;       // kNoPrefix if the url has no prefix
+        uint16_t flags;
     };
 
+    static const uint16_t kNoPrefix = 0xffff;
+
     HLSPlaylist();
     HLSPlaylist(const std::string& uri, const Memory& memory=Memory());
     HLSPlaylist(HLSPlaylist&& other);
     HLSPlaylist& operator=(HLSPlaylist&& other);
 
-    void addSegment(Segment&& segment);
+    //  adds the segment, storing its url within the string arena.  the
+    //  segment's uri fields are assigned by this method.
+    void addSegment(const Segment& segment, const char* url, size_t urlLen);
     int segmentCount() const { return _segments.size(); }
     Segment* segmentAt(int index);
     const Segment* segmentAt(int index) const;
+    //  appends the segment's resolved url to the supplied string
+    void appendSegmentUrl(const Segment& segment, std::string& out) const;
+
+    //  Binary snapshots store the playlist in a versioned, 8-byte aligned
+    //  layout so it can be restored (i.e. from a memory mapped file) without
+    //  parsing any text.  readSnapshot replaces the playlist contents and
+    //  returns false if the snapshot is invalid or of another version.
+    size_t snapshotSize() const;
+    bool writeSnapshot(Buffer& out) const;
+    bool readSnapshot(Buffer& in);
+
+    //  the playlist's url, the base for its segment urls
     const std::string& uri() const { return _uri; }
+    uint32_t mediaSequence() const { return _seqNo; }
+    uint32_t targetDuration() const { return _targetDuration; }    // seconds
+    int version() const { return _version; }
+    //  sum of segment durations.  durations are kept as integer microseconds
+    //  so this doesn't drift over long playlists.
+    uint64_t durationUs() const { return _durationUs; }
+    //  true once EXT-X-ENDLIST is seen.  live playlists must be refreshed.
+    bool ended() const { return _ended; }
+    //  EXT-X-SERVER-CONTROL CAN-SKIP-UNTIL, or 0 if delta updates are not
+    //  supported by the server.  like segment durations, it is clamped to
+    //  UINT32_MAX microseconds.
+    uint32_t canSkipUntilUs() const { return _canSkipUntilUs; }
+    //  returns the index of the segment with the given sequence number, or -1
+    int indexOfSequence(uint32_t seqNo) const;
+
+    //  bytes allocated for the segment table and url strings
+    size_t memoryUsage() const;
 
 private:
     friend class HLSPlaylistParser;
+    //  removes segments preceding seqNo, compacting the string arena once
+    //  most of it is unused.
+    void trimFront(uint32_t seqNo);
+    void compactStrings();
+    uint16_t findOrAddPrefix(const char* prefix, size_t len);
+
     std::string _uri;
-    int _seqNo;
-    float _targetDuration;
+    uint32_t _seqNo;
+    uint32_t _targetDuration;
     int _version;
+    bool _ended;
+    uint32_t _canSkipUntilUs;
+    uint64_t _durationUs;
     std::vector<Segment, std_allocator<Segment>> _segments;
+
+    //  url storage shared by all segments.  prefixes are kept until the
+    //  segments are released.
+    struct Prefix
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+    std::vector<char, std_allocator<char>> _strings;
+    std::vector<Prefix, std_allocator<Prefix>> _prefixes;
+    uint16_t _lastPrefix;
+    uint32_t _unusedStrings;                // bytes of trimmed suffixes
+};
+
+
+//  Splits arbitrary chunks of playlist data into lines.  Lines are passed to
+//  the callback as views into the chunk.  Only a line spanning two chunks is
+//  copied, into a carry buffer that is reused across lines.
+class HLSLineAssembler
+{
+public:
+    template<typename LineFn> void feed(const char* data, size_t len,
+                                        LineFn lineFn)
+    {
+        const char* last = data + len;
+        while (data != last)
+        {
+            const char* eol = reinterpret_cast<const char*>(
+                memchr(data, '\n', last - data));
+            if (!eol)
+            {
+                _partial.append(data, last);
+                break;
+            }
+            if (_partial.empty())
+            {
+                lineFn(data, eol - data);
+            }
+            else
+            {
+                _partial.append(data, eol);
+                lineFn(_partial.data(), _partial.size());
+                _partial.clear();
+            }
+            data = eol+1;
+        }
+    }
+
+    //  flushes a trailing line that had no terminating newline
+    template<typename LineFn> void finish(LineFn lineFn)
+    {
+        if (!_partial.empty())
+        {
+            lineFn(_partial.data(), _partial.size());
+            _partial.clear();
+        }
+    }
+
+private:
+    std::string _partial;
 };
 
 
@@ -76,11 +176,41 @@ class HLSPlaylistParser
 public:
     HLSPlaylistParser();
 
-    bool parse(HLSPlaylist& playlist, const std::string& line);
+    //  parses a chunk of playlist data as it arrives.  chunks may split lines
+    //  at any point.  segments are added to the playlist as soon as they are
+    //  complete.
+    bool feed(HLSPlaylist& playlist, const char* data, size_t len);
+    //  parses any remaining partial line once all data has been fed.
+    bool finish(HLSPlaylist& playlist);
+
+    //  parses a single line.  the line is a view into the caller's buffer
+    //  and need not be null-terminated.
+    //
+    //  if the playlist already contains segments, the input is treated as a
+    //  refresh of that playlist: segments that have left the live window are
+    //  removed, known segments are kept as is, and only new segments are
+    //  added.  this includes delta updates where known segments are
+    //  replaced by EXT-X-SKIP.
+    bool parse(HLSPlaylist& playlist, const char* line, size_t len);
+    bool parse(HLSPlaylist& playlist, const std::string& line) {
+        return parse(playlist, line.data(), line.size());
+    }
+
+    //  true if a delta update skipped segments beyond the last one held.
+    //  segments following the gap are not added, and the playlist should be
+    //  reloaded in full.
+    bool skipMismatch() const { return _skipMismatch; }
 
 private:
     enum { kInit, kInputLine, kPlaylistLine } _state;
     HLSPlaylist::Segment _info;
+    uint64_t _nextByteOffset;
+    uint32_t _nextSeqNo;
+    bool _updating;
+    uint32_t _lastSeqNo;        // last known segment when updating
+    bool _skipMismatch;
+    std::string _url;           // reused to resolve segment urls
+    HLSLineAssembler _lines;
 };
 
 class HLSMasterPlaylistParser;
@@ -88,13 +218,58 @@ class HLSMasterPlaylistParser;
 class HLSMasterPlaylist
 {
 public:
+    //  Codec identifiers are packed into a uint32_t as
+    //  [family:8][profile:8][constraints:8][level:8], so variants can be
+    //  matched against decoder capabilities without reparsing CODECS strings.
+    //  The family is a codecs::Family from the codec registry.
+
+    enum HDCPLevel
+    {
+        kHDCP_None,
+        kHDCP_Type0,
+        kHDCP_Type1
+    };
+
+    static uint32_t packCodec(codecs::Family family, uint8_t profile,
+                              uint8_t constraints, uint8_t level) {
+        return ((uint32_t)family << 24) | ((uint32_t)profile << 16) |
+               ((uint32_t)constraints << 8) | level;
+    }
+    static codecs::Family codecFamily(uint32_t codec) {
+        return (codecs::Family)(codec >> 24);
+    }
+    static uint8_t codecProfile(uint32_t codec) { return (codec >> 16) & 0xff; }
+    static uint8_t codecConstraints(uint32_t codec) { return (codec >> 8) & 0xff; }
+    static uint8_t codecLevel(uint32_t codec) { return codec & 0xff; }
+    static uint32_t codecFamilyBit(codecs::Family family) {
+        return 1u << family;
+    }
+
+    //  packs a single RFC 6381 codec string, i.e. "avc1.4d401f" or
+    //  "mp4a.40.2".  unrecognized codecs map to kFamily_None.
+    static uint32_t parseCodec(const char* str, size_t len);
+
     struct PlaylistInfo
     {
         uint32_t frameWidth = 0;
         uint32_t frameHeight = 0;
         uint32_t bandwidth = 0;
-        std::array<uint32_t, 4> codecs;         // more?
+        uint32_t averageBandwidth = 0;
+        uint32_t frameRate = 0;                 // frames per 1000 seconds
+        std::array<uint32_t, 4> codecs = {{ 0, 0, 0, 0 }};
+        uint32_t codecMask = 0;                 // codecFamilyBit values
+        HDCPLevel hdcpLevel = kHDCP_None;
         bool available = false;
+        std::string audioGroup;
+        std::string videoGroup;
+        std::string subtitlesGroup;
+        std::string closedCaptions;
+
+        //  true if every codec used by the variant is within familyMask,
+        //  a mask of codecFamilyBit values supported by the decoder.
+        bool decodable(uint32_t familyMask) const {
+            return !(codecMask & ~familyMask);
+        }
     };
 
     struct StreamInfo
@@ -108,6 +283,32 @@ public:
     HLSMasterPlaylist(const Memory& memory=Memory());
 
     StreamInfo* addStream(const PlaylistInfo& info, const std::string& uri);
+    int streamCount() const { return _playlists.size(); }
+    StreamInfo* streamAt(int index);
+    const StreamInfo* streamAt(int index) const;
+
+    //  Variant selection.  These use indices maintained by addStream, so they
+    //  run in O(log n) when the matching variants are available.  Variants
+    //  marked unavailable are skipped.  familyMask is a mask of
+    //  codecFamilyBit values the decoder supports.  Each returns the stream
+    //  index, or -1 if no variant qualifies.
+    //
+    //  highest bandwidth variant at or below maxBandwidth
+    int selectByBandwidth(uint32_t maxBandwidth, uint32_t familyMask) const;
+    //  lowest bandwidth variant
+    int selectLowestBandwidth(uint32_t familyMask) const;
+    //  largest resolution variant that fits within maxWidth x maxHeight
+    int selectByResolution(uint32_t maxWidth, uint32_t maxHeight,
+                           uint32_t familyMask) const;
+
+    //  Binary snapshot of all variants and their media playlists.  See
+    //  HLSPlaylist::writeSnapshot.
+    size_t snapshotSize() const;
+    bool writeSnapshot(Buffer& out) const;
+    bool readSnapshot(Buffer& in);
+
+    //  bytes allocated for the variant tables and every media playlist
+    size_t memoryUsage() const;
 
     Playlists::const_iterator begin() const {
         return _playlists.begin();
@@ -124,24 +325,59 @@ public:
 
 private:
     friend class HLSMasterPlaylistParser;
+    void indexStream(uint16_t index);
+
     Memory _memory;
 
     Playlists _playlists;
+
+    //  stream indices sorted by ranking criteria
+    using Index = std::vector<uint16_t, std_allocator<uint16_t>>;
+    Index _byBandwidth;
+    Index _byResolution;
+    //  sorted by codec mask, then bandwidth.  each run of identical codec
+    //  masks is a CodecGroup.
+    Index _byCodecBandwidth;
+    struct CodecGroup
+    {
+        uint32_t codecMask;
+        uint16_t first;
+        uint16_t last;
+    };
+    std::vector<CodecGroup, std_allocator<CodecGroup>> _codecGroups;
 };
 
 class HLSMasterPlaylistParser
 {
 public:
-    HLSMasterPlaylistParser();
+    //  variant playlist uris are resolved against baseUrl, normally the
+    //  url of the master playlist.
+    HLSMasterPlaylistParser(const std::string& baseUrl=std::string());
+
+    //  parses a chunk of playlist data as it arrives.  chunks may split lines
+    //  at any point.
+    bool feed(HLSMasterPlaylist& playlist, const char* data, size_t len);
+    //  parses any remaining partial line once all data has been fed.
+    bool finish(HLSMasterPlaylist& playlist);
 
-    bool parse(HLSMasterPlaylist& playlist, const std::string& line);
+    //  parses a single line.  the line is a view into the caller's buffer
+    //  and need not be null-terminated.
+    bool parse(HLSMasterPlaylist& playlist, const char* line, size_t len);
+    bool parse(HLSMasterPlaylist& playlist, const std::string& line) {
+        return parse(playlist, line.data(), line.size());
+    }
 
 private:
-    void parseCodecs(const std::string& line);
+    void parseStreamAttribute(const char* name, size_t nameLen,
+                              const char* value, size_t valueLen);
+    void parseCodecs(const char* str, size_t len);
 
     enum { kInit, kInputLine, kPlaylistLine } _state;
     HLSMasterPlaylist::PlaylistInfo _info;
     int _version;
+    std::string _baseUrl;
+    std::string _url;
+    HLSLineAssembler _lines;
 };
 
 } /* namespace cinekav */
@@ -9,7 +9,9 @@
  */
 
 #include "hlstream.hpp"
+#include <chrono>
 #include <string>
+#include <cstring>
 
 namespace cinekav {
 
@@ -22,7 +24,8 @@ namespace cinekav {
  *  - Set State to MEDIALIST
  *   - Select media playlist from PLAYLIST - use mid-range bandwidth stream for 
  *     now
- *   - LOAD_LIST(root URL + media PL) and parse to MEDIALIST
+ *   - LOAD_LIST(media PL URL, resolved against the root URL) and parse to
+ *     MEDIALIST
  *  - Set State to PLAYBACK with current MEDIALIST at start
  *   - PLAY_LIST(Media Playlist ID)
  *
@@ -44,14 +47,27 @@ HLStream::HLStream
 ) :
     _memory(memory),
     _inputCbs(inputCbs),
-    _state(kOpenRootList),
+    _state(kStart),
     _inputRequestHandle(0),
     _inputResourceHandle(0),
+    _inputRemaining(0),
     _masterPlaylist(memory),
     _toParsePlaylist(_masterPlaylist.end()),
     _toPlayPlaylist(_masterPlaylist.end()),
-    _rootUrl(url),
+    _url(url),
     _playlistSegmentIndex(-1),
+    _refreshSeqNo(0),
+    _nextRefreshUs(0),
+    _playlistLoadUs(kNoTime),
+    _refreshRequestUs(0),
+    _refreshFull(false),
+    _refreshHash(0),
+    _refreshHashPlaylist(-1),
+    _refreshStats(),
+    _memoryBudget(0),
+    _segmentSizeEstimate(0),
+    _maxBandwidth(0),
+    _familyMask(~0u),
     _videoBuffer(std::move(videoBuffer)),
     _audioBuffer(std::move(audioBuffer)),
     _demuxer([this](cinekav::ElementaryStream::Type type,
@@ -74,25 +90,16 @@ HLStream::HLStream
                 return handleOverflowES(programId, index, len);
             },
             _memory),
-    _audioESIndex(0x01),
-    _videoESIndex(0x80),
+    _audioESIndex(0x80),
+    _videoESIndex(0x01),
     _bufferCount(2),        // todo, make this a setting
+    _videoPool(_memory),
+    _audioPool(_memory),
+    _videoBlocks(_bufferCount, nullptr, _memory),
+    _audioBlocks(_bufferCount, nullptr, _memory),
     _audioStreams(_memory),
     _videoStreams(_memory)
 {
-    _inputRequestHandle = _inputCbs.openCb(url);
-    
-    //  if the url ends with a filename, strip it out
-    auto endpos = _rootUrl.find_last_of('/');
-    if (endpos != std::string::npos)
-    {
-        auto ext = _rootUrl.find_first_of('.', endpos);
-        if (ext != std::string::npos)
-        {
-            _rootUrl = _rootUrl.substr(0, endpos+1);
-        }
-    }
-
     _audioStreams.reserve(_bufferCount);
     _videoStreams.reserve(_bufferCount);
 
@@ -102,11 +109,17 @@ HLStream::HLStream
         _videoStreams.emplace_back();
     }
 
+    _videoPool.reset(_videoBuffer.obtain(0), _videoBuffer.available(),
+                     _bufferCount);
+    _audioPool.reset(_audioBuffer.obtain(0), _audioBuffer.available(),
+                     _bufferCount);
+
     resetStreams();
 }
 
 HLStream::~HLStream()
 {
+    releaseSlotBlocks();
     if (_inputResourceHandle)
     {
         _inputCbs.closeCb(_inputResourceHandle);
@@ -117,8 +130,15 @@ void HLStream::update()
 {
     switch(_state)
     {
+    case kStart:
+        {
+            _inputRequestHandle = _inputCbs.openCb(_url.c_str());
+            _state = kOpenRootList;
+        }
+        break;
     case kOpenRootList:
     case kOpenMediaList:
+    case kOpenRefreshList:
     case kOpenSegment:
         {
             //  attempt to read the root playlist.  when read, proceed.
@@ -126,20 +146,69 @@ void HLStream::update()
             if (status == StreamInputCallbacks::Result::kComplete)
             {
                 size_t fileSize = _inputCbs.sizeCb(_inputResourceHandle);
+                if (_state == kOpenSegment && fileSize != 0)
+                {
+                    _segmentSizeEstimate = fileSize;
+                    if (!reserveBudget(fileSize))
+                    {
+                        //  fetched again once buffered output has drained
+                        _inputCbs.closeCb(_inputResourceHandle);
+                        _inputResourceHandle = 0;
+                        if (_state != kMemoryError)
+                            _state = kDownloadSegment;
+                        break;
+                    }
+                }
                 if (fileSize != 0)
                 {
-                    _inputBuffer = Buffer(fileSize, _memory);
-                    uint8_t* buf = _inputBuffer.obtain(fileSize);
+                    //  playlists are read in chunks and parsed as each
+                    //  arrives.  segments are read whole, as are refreshed
+                    //  playlists so they can be compared before parsing.
+                    size_t readSize = fileSize;
+                    if ((_state == kOpenRootList || _state == kOpenMediaList) &&
+                        readSize > kPlaylistChunkSize)
+                    {
+                        readSize = kPlaylistChunkSize;
+                    }
+                    _inputRemaining = fileSize;
+                    //  the input buffer only grows, so once it holds the
+                    //  largest segment seen it is reused without faulting
+                    //  in fresh pages.  the previous buffer is released
+                    //  first so both are never held at once.
+                    if ((size_t)_inputBuffer.capacity() < readSize)
+                    {
+                        _inputBuffer = Buffer();
+                        //  segments are large and scanned sequentially by
+                        //  the demuxer
+                        AllocHints hints;
+                        if (_state == kOpenSegment)
+                        {
+                            hints = AllocHints(64, AllocHints::kHugePages |
+                                                   AllocHints::kPrefault);
+                        }
+                        _inputBuffer = Buffer(readSize, hints, _memory);
+                    }
+                    _inputBuffer.reset();
+                    //  refreshes commit bytes to the buffer as reads complete
+                    uint8_t* buf = _inputBuffer.obtain(
+                        _state == kOpenRefreshList ? 0 : readSize);
                     if (buf)
                     {
                         _inputRequestHandle = _inputCbs.readCb(
                             _inputResourceHandle,
                             buf,
-                            fileSize);
+                            readSize);
+                        if (_state == kOpenRootList)
+                            _masterParser = HLSMasterPlaylistParser(_url);
+                        else if (_state == kOpenMediaList ||
+                                 _state == kOpenRefreshList)
+                            _mediaParser = HLSPlaylistParser();
                         if (_state == kOpenRootList)
                             _state = kReadRootList;
                         else if (_state == kOpenMediaList)
                             _state = kReadMediaList;
+                        else if (_state == kOpenRefreshList)
+                            _state = kReadRefreshList;
                         else if (_state == kOpenSegment)
                             _state = kReadSegment;
                         else
@@ -150,6 +219,10 @@ void HLStream::update()
                         _state = kMemoryError;
                     }
                 }
+                else if (_state == kOpenRefreshList)
+                {
+                    failRefresh();
+                }
                 else
                 {
                     _state = kNoStreamError;
@@ -158,7 +231,14 @@ void HLStream::update()
             else if (status == StreamInputCallbacks::Result::kError ||
                      status == StreamInputCallbacks::Result::kInvalid)
             {
-                _state = kNoStreamError;
+                //  a failed or empty refresh leaves the current window
+                //  playable.  retry on the next refresh interval.
+                if (_state == kOpenRefreshList)
+                {
+                    failRefresh();
+                }
+                else
+                    _state = kNoStreamError;
             }
             if (_state == kNoStreamError)
             {
@@ -181,33 +261,29 @@ void HLStream::update()
             auto status = _inputCbs.resultCb(_inputRequestHandle, &cnt);
             if (status == StreamInputCallbacks::Result::kComplete)
             {
-                HLSMasterPlaylistParser parser;
-                StringBuffer sb(std::move(_inputBuffer));
-                while (!sb.end())
-                {
-                    std::string line;
-                    line.reserve(80);
-                    sb.getline(line);
-                    parser.parse(_masterPlaylist, line);
-                }
-                
-                
+                if (cnt > (uintptr_t)_inputBuffer.size())
+                    cnt = _inputBuffer.size();
+                _masterParser.feed(_masterPlaylist,
+                                   (const char*)_inputBuffer.head(), cnt);
+                if (readNextChunk(cnt))
+                    break;
+
+                _masterParser.finish(_masterPlaylist);
+
+                //  the variant table is complete, so iterators into it stay
+                //  valid from here on.  nothing plays until a variant is
+                //  selected.
+                _toPlayPlaylist = _masterPlaylist.end();
+                //  no media playlist is older than this
+                _playlistLoadUs = currentTimeUs();
+
                 //  now open each stream in the master playlist by
                 //  switch to the kOpenMediaList state.
                 _toParsePlaylist = _masterPlaylist.begin();
                 if (_toParsePlaylist != _masterPlaylist.end())
                 {
-                    std::string url;
-                    if (!_toParsePlaylist->playlist.uri().compare(0, 5, "http:") ||
-                        !_toParsePlaylist->playlist.uri().compare(0, 6, "https:"))
-                    {
-                        url = _toParsePlaylist->playlist.uri();
-                    }
-                    else
-                    {
-                        url = _rootUrl + _toParsePlaylist->playlist.uri();
-                    }
-                    _inputRequestHandle = _inputCbs.openCb(url.c_str());
+                    _inputRequestHandle = _inputCbs.openCb(
+                        _toParsePlaylist->playlist.uri().c_str());
                     _state = kOpenMediaList;
                 }
                 else
@@ -234,16 +310,16 @@ void HLStream::update()
             auto status = _inputCbs.resultCb(_inputRequestHandle, &cnt);
             if (status == StreamInputCallbacks::Result::kComplete)
             {
-                HLSPlaylistParser parser;
-                StringBuffer sb(std::move(_inputBuffer));
-                while (!sb.end())
-                {
-                    std::string line;
-                    line.reserve(80);
-                    sb.getline(line);
-                    parser.parse(_toParsePlaylist->playlist, line);
-                }
+                //  segments parsed from this chunk are available in the
+                //  playlist immediately.
+                if (cnt > (uintptr_t)_inputBuffer.size())
+                    cnt = _inputBuffer.size();
+                _mediaParser.feed(_toParsePlaylist->playlist,
+                                  (const char*)_inputBuffer.head(), cnt);
+                if (readNextChunk(cnt))
+                    break;
 
+                _mediaParser.finish(_toParsePlaylist->playlist);
                 _toParsePlaylist->info.available = true;
                 
                 //  now open each stream in the master playlist by
@@ -251,17 +327,17 @@ void HLStream::update()
                 ++_toParsePlaylist;
                 if (_toParsePlaylist != _masterPlaylist.end())
                 {
-                    std::string url = _rootUrl + _toParsePlaylist->playlist.uri();
-                    _inputRequestHandle = _inputCbs.openCb(url.c_str());
+                    _inputRequestHandle = _inputCbs.openCb(
+                        _toParsePlaylist->playlist.uri().c_str());
                     _state = kOpenMediaList;
                 }
                 else
                 {
-                    //  select a stream to play - for now, the 1st until the
-                    //  library is more fleshed out
-                    //
-                    _toPlayPlaylist = _masterPlaylist.begin();
+                    //  every variant is known, so select one to play
+                    _toPlayPlaylist = _masterPlaylist.begin() + selectVariant();
                     resetStreams();
+                    scheduleRefresh(
+                        _toPlayPlaylist->playlist.targetDuration() * 1000000ull);
                     _state = kDownloadSegment;
                 }
             }
@@ -276,6 +352,93 @@ void HLStream::update()
             }
         }
         break;
+    case kReadRefreshList:
+        {
+            uintptr_t cnt;
+            auto status = _inputCbs.resultCb(_inputRequestHandle, &cnt);
+            if (status == StreamInputCallbacks::Result::kComplete)
+            {
+                if (cnt > (uintptr_t)_inputBuffer.available())
+                    cnt = _inputBuffer.available();
+                _inputBuffer.obtain((int)cnt);
+                _inputRemaining -= (cnt < _inputRemaining) ? cnt :
+                                                             _inputRemaining;
+                if (cnt && _inputRemaining && _inputBuffer.available())
+                {
+                    size_t readSize = _inputBuffer.available();
+                    if (readSize > _inputRemaining)
+                        readSize = _inputRemaining;
+                    _inputRequestHandle = _inputCbs.readCb(
+                        _inputResourceHandle,
+                        _inputBuffer.obtain(0),
+                        readSize);
+                    break;
+                }
+                _inputCbs.closeCb(_inputResourceHandle);
+                _inputResourceHandle = 0;
+
+                //  a byte-identical body is skipped without parsing.
+                //  otherwise the parser splices the refresh into the existing
+                //  playlist, so only new segments are added.
+                auto& playlist = _toParsePlaylist->playlist;
+                int playlistIndex = (int)(_toParsePlaylist - _masterPlaylist.begin());
+                uint64_t hash = Hash64::compute(_inputBuffer.head(),
+                                                _inputBuffer.size());
+                ++_refreshStats.refreshCount;
+                _refreshStats.bytesRead += _inputBuffer.size();
+                if (playlistIndex == _refreshHashPlaylist && hash == _refreshHash)
+                {
+                    ++_refreshStats.unchangedCount;
+                }
+                else
+                {
+                    _mediaParser.feed(playlist,
+                                      (const char*)_inputBuffer.head(),
+                                      _inputBuffer.size());
+                    _mediaParser.finish(playlist);
+                    _refreshStats.bytesParsed += _inputBuffer.size();
+                    _refreshHash = hash;
+                    _refreshHashPlaylist = playlistIndex;
+                }
+                _playlistLoadUs = _refreshRequestUs;
+
+                //  a delta update that skipped segments we don't hold left
+                //  the playlist short.  reload it in full right away.
+                if (_mediaParser.skipMismatch())
+                {
+                    ++_refreshStats.failedCount;
+                    _refreshHashPlaylist = -1;
+                    _refreshFull = true;
+                    refreshMediaList();
+                    break;
+                }
+
+                //  relocate the next segment within the new window.  if we
+                //  fell behind the window, resume from its start.
+                int index = playlist.indexOfSequence(_refreshSeqNo);
+                if (index < 0)
+                {
+                    index = (_refreshSeqNo < playlist.mediaSequence()) ?
+                            0 : playlist.segmentCount();
+                }
+                _playlistSegmentIndex = index;
+
+                //  poll again after a target duration if the playlist
+                //  changed, or half of one if it did not (RFC 8216 6.3.4)
+                uint64_t intervalUs = playlist.targetDuration() * 1000000ull;
+                if (index >= playlist.segmentCount())
+                    intervalUs /= 2;
+                scheduleRefresh(intervalUs);
+                _toParsePlaylist = _masterPlaylist.end();
+                _state = kDownloadSegment;
+            }
+            else if (status == StreamInputCallbacks::Result::kError ||
+                     status == StreamInputCallbacks::Result::kInvalid)
+            {
+                failRefresh();
+            }
+        }
+        break;
     case kDownloadSegment:
         {
             //  HLStream's job is to fill the video and audio buffers with data
@@ -304,14 +467,27 @@ void HLStream::update()
             auto& playlist =  (*_toPlayPlaylist).playlist;
             if (_playlistSegmentIndex < playlist.segmentCount())
             {
-                if (_videoPos.hasWriteSpace() && _audioPos.hasWriteSpace())
+                //  stream buffers still referenced by retained access units
+                //  hold back the download until they are released
+                if (_videoPos.hasWriteSpace() && _audioPos.hasWriteSpace() &&
+                    isSlotWritable(_videoBlocks, _videoPos.writeToIdx) &&
+                    isSlotWritable(_audioBlocks, _audioPos.writeToIdx) &&
+                    reserveBudget(_segmentSizeEstimate))
                 {
+                    //  segment urls were resolved when the playlist was
+                    //  parsed.  the url string keeps its capacity, so once it
+                    //  fits the longest url no further allocations are made.
                     auto& segment = *playlist.segmentAt(_playlistSegmentIndex);
-                    std::string url = _rootUrl + segment.uri;
-                    _inputRequestHandle = _inputCbs.openCb(url.c_str());
+                    _segmentUrl.clear();
+                    playlist.appendSegmentUrl(segment, _segmentUrl);
+                    _inputRequestHandle = _inputCbs.openCb(_segmentUrl.c_str());
                     _state = kOpenSegment;
                 }
             }
+            else if (!playlist.ended() && currentTimeUs() >= _nextRefreshUs)
+            {
+                refreshMediaList();
+            }
         }
         break;
     case kReadSegment:
@@ -319,6 +495,12 @@ void HLStream::update()
             //  demux the read-in segment
             uintptr_t cnt;
             auto status = _inputCbs.resultCb(_inputRequestHandle, &cnt);
+            if (status != StreamInputCallbacks::Result::kPending)
+            {
+                //  the segment is read whole, so its input is done with
+                _inputCbs.closeCb(_inputResourceHandle);
+                _inputResourceHandle = 0;
+            }
             if (status == StreamInputCallbacks::Result::kComplete)
             {
                 //  prepare to read the next segment
@@ -349,8 +531,126 @@ void HLStream::update()
     }
 }
 
+//  HLStream snapshot header, followed by the stream url and the master
+//  playlist snapshot block.
+static const uint32_t kStreamSnapshotMagic = 0x53484b43;    // 'CKHS'
+static const uint16_t kStreamSnapshotVersion = 2;
+
+struct StreamSnapshotHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    int32_t playlistIndex;
+    int32_t segmentIndex;
+    uint32_t urlLength;
+    uint32_t reserved2;
+};
+
+size_t HLStream::snapshotSize() const
+{
+    return sizeof(StreamSnapshotHeader) + ((_url.size() + 7) & ~7) +
+           _masterPlaylist.snapshotSize();
+}
+
+bool HLStream::saveSnapshot(Buffer& out) const
+{
+    //  no variant is selected until every media playlist has been read
+    if (_state == kStart || _state == kOpenRootList ||
+        _state == kReadRootList || _toPlayPlaylist == _masterPlaylist.end())
+    {
+        return false;
+    }
+
+    StreamSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kStreamSnapshotMagic;
+    header.version = kStreamSnapshotVersion;
+    header.playlistIndex = (int32_t)(_toPlayPlaylist - _masterPlaylist.begin());
+    header.segmentIndex = _playlistSegmentIndex;
+    header.urlLength = (uint32_t)_url.size();
+
+    int urlSize = (int)((_url.size() + 7) & ~7);
+    uint8_t* p = out.obtain(sizeof(header) + urlSize);
+    if (!p)
+        return false;
+    memcpy(p, &header, sizeof(header));
+    memset(p + sizeof(header), 0, urlSize);
+    memcpy(p + sizeof(header), _url.data(), _url.size());
+
+    return _masterPlaylist.writeSnapshot(out);
+}
+
+bool HLStream::restoreSnapshot(Buffer& in)
+{
+    if (_state != kStart || in.size() < (int)sizeof(StreamSnapshotHeader))
+        return false;
+
+    StreamSnapshotHeader header;
+    memcpy(&header, in.head(), sizeof(header));
+    if (header.magic != kStreamSnapshotMagic ||
+        header.version != kStreamSnapshotVersion)
+    {
+        return false;
+    }
+    in.skip(sizeof(header));
+    size_t urlSize = ((size_t)header.urlLength + 7) & ~(size_t)7;
+    if ((size_t)in.size() < urlSize)
+        return false;
+    std::string url((const char*)in.head(), header.urlLength);
+    in.skip((int)urlSize);
+
+    //  nothing is replaced until the whole snapshot has been validated
+    HLSMasterPlaylist master(_memory);
+    if (!master.readSnapshot(in))
+        return false;
+    if (header.playlistIndex < 0 ||
+        header.playlistIndex >= master.streamCount())
+    {
+        return false;
+    }
+    //  the index may be one past the last segment, as it is once a live
+    //  window has been played out
+    const HLSPlaylist& playlist = master.streamAt(header.playlistIndex)->playlist;
+    if (header.segmentIndex < 0 ||
+        header.segmentIndex > playlist.segmentCount())
+    {
+        return false;
+    }
+
+    _masterPlaylist = std::move(master);
+    _url = std::move(url);
+    _toParsePlaylist = _masterPlaylist.end();
+    _toPlayPlaylist = _masterPlaylist.begin() + header.playlistIndex;
+    resetStreams();
+    _playlistSegmentIndex = header.segmentIndex;
+    _playlistLoadUs = kNoTime;
+    _state = kDownloadSegment;
+    return true;
+}
+
 //  obtain encoded data from our current read buffer.  
 int HLStream::pullEncodedData(ESAccessUnit* vau, ESAccessUnit* aau)
+{
+    return pullAccessUnits(vau, aau, false);
+}
+
+int HLStream::acquireEncodedData(ESAccessUnit* vau, ESAccessUnit* aau)
+{
+    return pullAccessUnits(vau, aau, true);
+}
+
+void HLStream::releaseAccessUnit(ESAccessUnit& au)
+{
+    if (au.block)
+    {
+        BlockPool::release(au.block);
+        au.block = nullptr;
+    }
+}
+
+int HLStream::pullAccessUnits(ESAccessUnit* vau, ESAccessUnit* aau,
+                              bool retain)
 {
     int res = 0;
 
@@ -362,13 +662,22 @@ int HLStream::pullEncodedData(ESAccessUnit* vau, ESAccessUnit* aau)
         if (_videoPos.readAUIdx < vstream.accessUnitCount())
         {
             *vau = *vstream.accessUnit(_videoPos.readAUIdx);
+            if (retain)
+            {
+                vau->block = _videoBlocks[_videoPos.readFromIdx];
+                BlockPool::addRef(vau->block);
+            }
             res |= 0x01;
             ++_videoPos.readAUIdx;
         }
         if (_videoPos.readAUIdx >= vstream.accessUnitCount())
         {
+            //  a drained stream's access unit table is no longer needed
             if (_videoPos.advanceRead())
+            {
+                vstream = ElementaryStream();
                 _videoPos.readAUIdx = 0;
+            }
         }
     }
 
@@ -380,13 +689,21 @@ int HLStream::pullEncodedData(ESAccessUnit* vau, ESAccessUnit* aau)
         if (_audioPos.readAUIdx < astream.accessUnitCount())
         {
             *aau = *astream.accessUnit(_audioPos.readAUIdx);
+            if (retain)
+            {
+                aau->block = _audioBlocks[_audioPos.readFromIdx];
+                BlockPool::addRef(aau->block);
+            }
             res |= 0x02;
             ++_audioPos.readAUIdx;
         }
         if (_audioPos.readAUIdx >= astream.accessUnitCount())
         {
             if (_audioPos.advanceRead())
+            {
+                astream = ElementaryStream();
                 _audioPos.readAUIdx = 0;
+            }
         }
     }
     return res;
@@ -415,16 +732,17 @@ cinekav::ElementaryStream* HLStream::createES
     {
     case cinekav::ElementaryStream::kVideo_H264:        // video
         { 
-            if (_videoESIndex == 0)
+            //  video indices stay below 0x80, where getES looks for them
+            if (_videoESIndex == 0 || _videoESIndex >= 0x80)
                 _videoESIndex = 1;
             uint8_t esIndex = _videoESIndex++;
 
 
             int thisIdx = _videoPos.writeToIdx;
-            const int kBufferSize = _videoBuffer.available()/2;
-            Buffer streamBuffer = _videoBuffer.createSubBuffer(
-                thisIdx * kBufferSize,
-                kBufferSize);
+            Buffer streamBuffer = acquireSlotBuffer(_videoPool, _videoBlocks,
+                                                    thisIdx);
+            if (!streamBuffer.capacity())
+                break;
             ElementaryStream estream(std::move(streamBuffer), type, programId,
                                         esIndex);
              
@@ -440,10 +758,10 @@ cinekav::ElementaryStream* HLStream::createES
 
 
             int thisIdx = _audioPos.writeToIdx;
-            const int kBufferSize = _audioBuffer.available()/2;
-            Buffer streamBuffer = _audioBuffer.createSubBuffer(
-                thisIdx * kBufferSize,
-                kBufferSize);
+            Buffer streamBuffer = acquireSlotBuffer(_audioPool, _audioBlocks,
+                                                    thisIdx);
+            if (!streamBuffer.capacity())
+                break;
             ElementaryStream estream(std::move(streamBuffer), type, programId,
                                         esIndex);
              
@@ -459,6 +777,44 @@ cinekav::ElementaryStream* HLStream::createES
     return stream;
 }
 
+//  Replaces the block held by a stream buffer slot.  The slot's previous
+//  block is normally reacquired, unless access units still reference it.
+Buffer HLStream::acquireSlotBuffer(BlockPool& pool, Blocks& blocks, int idx)
+{
+    if (blocks[idx])
+    {
+        BlockPool::release(blocks[idx]);
+        blocks[idx] = nullptr;
+    }
+    BlockPool::Block* block = pool.acquire();
+    if (!block)
+        return Buffer(nullptr, 0);
+
+    blocks[idx] = block;
+    return Buffer(block->data, 0, (int)pool.blockSize());
+}
+
+bool HLStream::isSlotWritable(const Blocks& blocks, int idx)
+{
+    return !blocks[idx] || BlockPool::refCount(blocks[idx]) == 1;
+}
+
+void HLStream::releaseSlotBlocks()
+{
+    for (auto& block : _videoBlocks)
+    {
+        if (block)
+            BlockPool::release(block);
+        block = nullptr;
+    }
+    for (auto& block : _audioBlocks)
+    {
+        if (block)
+            BlockPool::release(block);
+        block = nullptr;
+    }
+}
+
 cinekav::ElementaryStream* HLStream::getES
     (
         uint16_t programId,
@@ -509,6 +865,157 @@ cinekav::ElementaryStream* HLStream::handleOverflowES(uint16_t programId,
     return nullptr;
 }
 
+bool HLStream::readNextChunk(uintptr_t lastReadCnt)
+{
+    _inputRemaining -= (lastReadCnt < _inputRemaining) ? lastReadCnt :
+                                                         _inputRemaining;
+    if (!_inputRemaining || !lastReadCnt)
+    {
+        _inputCbs.closeCb(_inputResourceHandle);
+        _inputResourceHandle = 0;
+        return false;
+    }
+
+    size_t readSize = _inputBuffer.capacity();
+    if (readSize > _inputRemaining)
+        readSize = _inputRemaining;
+    _inputBuffer.reset();
+    uint8_t* buf = _inputBuffer.obtain(readSize);
+    _inputRequestHandle = _inputCbs.readCb(_inputResourceHandle, buf, readSize);
+    return true;
+}
+
+void HLStream::refreshMediaList()
+{
+    auto playlistIndex = _toPlayPlaylist - _masterPlaylist.begin();
+    _toParsePlaylist = _masterPlaylist.begin() + playlistIndex;
+
+    auto& playlist = _toParsePlaylist->playlist;
+    _refreshSeqNo = playlist.mediaSequence() + playlist.segmentCount();
+    if (playlist.segmentCount() > 0)
+    {
+        _refreshSeqNo = playlist.segmentAt(playlist.segmentCount()-1)->seqNo + 1;
+    }
+
+    _refreshRequestUs = currentTimeUs();
+    bool recent = _playlistLoadUs != kNoTime &&
+                  _refreshRequestUs - _playlistLoadUs <
+                    playlist.canSkipUntilUs() / 2;
+
+    std::string url = playlist.uri();
+    if (playlist.canSkipUntilUs() && playlist.segmentCount() > 0 &&
+        recent && !_refreshFull)
+    {
+        //  the server replaces segments we already hold with EXT-X-SKIP
+        url += (url.find('?') == std::string::npos) ? '?' : '&';
+        url += "_HLS_skip=YES";
+    }
+    _refreshFull = false;
+    _inputRequestHandle = _inputCbs.openCb(url.c_str());
+    _state = kOpenRefreshList;
+}
+
+void HLStream::failRefresh()
+{
+    ++_refreshStats.failedCount;
+    if (_inputResourceHandle)
+    {
+        _inputCbs.closeCb(_inputResourceHandle);
+        _inputResourceHandle = 0;
+    }
+    _toParsePlaylist = _masterPlaylist.end();
+    scheduleRefresh(_toPlayPlaylist->playlist.targetDuration() * 1000000ull / 2);
+    _state = kDownloadSegment;
+}
+
+bool HLStream::ended() const
+{
+    if (_state != kDownloadSegment)
+        return false;
+    auto& playlist = _toPlayPlaylist->playlist;
+    return playlist.ended() &&
+           _playlistSegmentIndex >= playlist.segmentCount();
+}
+
+bool HLStream::failed() const
+{
+    return _state == kNoStreamError || _state == kInStreamError ||
+           _state == kMemoryError || _state == kInternalError;
+}
+
+int HLStream::selectVariant() const
+{
+    if (!_maxBandwidth)
+        return 0;
+    int index = _masterPlaylist.selectByBandwidth(_maxBandwidth, _familyMask);
+    if (index < 0)
+        index = _masterPlaylist.selectLowestBandwidth(_familyMask);
+    return index < 0 ? 0 : index;
+}
+
+uint64_t HLStream::currentTimeUs() const
+{
+    if (_inputCbs.timeCb)
+        return _inputCbs.timeCb();
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void HLStream::scheduleRefresh(uint64_t intervalUs)
+{
+    _nextRefreshUs = currentTimeUs() + intervalUs;
+}
+
+size_t HLStream::memoryUsage() const
+{
+    size_t usage = _inputBuffer.capacity() + _masterPlaylist.memoryUsage() +
+                   _segmentUrl.capacity();
+    for (auto& stream : _videoStreams)
+    {
+        usage += stream.memoryUsage();
+    }
+    for (auto& stream : _audioStreams)
+    {
+        usage += stream.memoryUsage();
+    }
+    return usage;
+}
+
+//  Without room for the segment, caches are trimmed first.  Failing that
+//  the fetch is deferred, in effect shrinking the prefetch depth, until the
+//  buffered output drains.  With nothing left to drain the stream fails.
+bool HLStream::reserveBudget(size_t inputSize)
+{
+    if (!_memoryBudget)
+        return true;
+
+    //  the input buffer grows to fit the segment if it is too small
+    size_t inputCapacity = _inputBuffer.capacity();
+    if (memoryUsage() - inputCapacity +
+            (inputSize > inputCapacity ? inputSize : inputCapacity) <=
+        _memoryBudget)
+    {
+        return true;
+    }
+
+    trimMemory();
+    if (memoryUsage() + inputSize <= _memoryBudget)
+        return true;
+
+    if (!_videoPos.hasReadSpace() && !_audioPos.hasReadSpace())
+    {
+        _state = kMemoryError;
+    }
+    return false;
+}
+
+//  Frees the idle input buffer.  The segment tables of variants not playing
+//  are kept, since nothing would reload them.
+void HLStream::trimMemory()
+{
+    _inputBuffer = Buffer();
+}
+
 void HLStream::StreamPosition::reset(int cnt)
 {
     readFromIdx = 0;
@@ -570,6 +1077,7 @@ void HLStream::resetStreams()
         _audioStreams[i] = ElementaryStream();
         _videoStreams[i] = ElementaryStream();
     }
+    releaseSlotBlocks();
 
    
     _playlistSegmentIndex = 0;
@@ -35,10 +35,67 @@ public:
 
     virtual void update() override;
 
+    //  true once every segment of an ended playlist has been demuxed.  units
+    //  may remain to be pulled.
+    bool ended() const;
+    //  true if the stream stopped on an error it cannot recover from
+    bool failed() const;
+
     //  Obtain encoded data from our current read buffer.  This method advances
     //  may advance the read pointer as needed
     int pullEncodedData(ESAccessUnit* vau, ESAccessUnit* aau);
 
+    //  As pullEncodedData, but each returned unit holds a reference to the
+    //  pooled block containing its data.  The data remains valid until the
+    //  unit is passed to releaseAccessUnit, which may be called from any
+    //  thread.  Held blocks are not refilled, so segment downloads wait on
+    //  units that are never released.
+    int acquireEncodedData(ESAccessUnit* vau, ESAccessUnit* aau);
+    static void releaseAccessUnit(ESAccessUnit& au);
+
+    //  Snapshots capture the parsed playlists and the current segment
+    //  position so a restarted stream can resume downloading segments without
+    //  fetching or parsing any playlists.  A snapshot can be saved once
+    //  playback has started.  restoreSnapshot must be called before the
+    //  first update().
+    size_t snapshotSize() const;
+    bool saveSnapshot(Buffer& out) const;
+    bool restoreSnapshot(Buffer& in);
+
+    //  Live playlist refresh statistics
+    struct RefreshStats
+    {
+        uint32_t refreshCount;          // completed refreshes
+        uint32_t unchangedCount;        // refreshes skipped as unchanged
+        uint32_t failedCount;
+        uint64_t bytesRead;
+        uint64_t bytesParsed;
+    };
+    const RefreshStats& refreshStats() const { return _refreshStats; }
+
+    //  Limits the memory the stream allocates beyond the application's video
+    //  and audio buffers: the segment input buffer, playlists and access
+    //  unit tables.  When the next segment would exceed the budget, the
+    //  stream frees what it can and then defers the fetch until buffered
+    //  output drains.  A segment that cannot fit with nothing buffered fails
+    //  the stream with a memory error.  0 disables the budget.
+    void setMemoryBudget(size_t bytes) { _memoryBudget = bytes; }
+    size_t memoryBudget() const { return _memoryBudget; }
+    //  memory counted against the budget
+    size_t memoryUsage() const;
+
+    //  Chooses the variant to play once every media playlist has been read:
+    //  the highest bandwidth variant at or below maxBandwidth whose codecs
+    //  are all in familyMask (see HLSMasterPlaylist::selectByBandwidth), or
+    //  the lowest bandwidth one if none fits.  With a maxBandwidth of 0, the
+    //  default, the first listed variant plays.  Call before the first
+    //  update().
+    void setVariantLimits(uint32_t maxBandwidth, uint32_t familyMask=~0u)
+    {
+        _maxBandwidth = maxBandwidth;
+        _familyMask = familyMask;
+    }
+
 private:
     cinekav::ElementaryStream* createES(cinekav::ElementaryStream::Type,
                                uint16_t programId);
@@ -50,16 +107,40 @@ private:
                                        uint16_t index,
                                        uint32_t len);
 
+    int pullAccessUnits(ESAccessUnit* vau, ESAccessUnit* aau, bool retain);
+
+    //  requests the next chunk of the current input resource, returning false
+    //  once the resource has been completely read.
+    bool readNextChunk(uintptr_t lastReadCnt);
+
+    //  reloads the playing live playlist, requesting a delta update when the
+    //  server supports one and the held playlist is recent enough.
+    void refreshMediaList();
+    //  abandons the refresh in progress, retrying after half a target
+    //  duration
+    void failRefresh();
+    uint64_t currentTimeUs() const;
+    void scheduleRefresh(uint64_t intervalUs);
+    int selectVariant() const;
+
+    //  returns true if a segment of inputSize bytes fits within the budget,
+    //  freeing caches as needed.
+    bool reserveBudget(size_t inputSize);
+    void trimMemory();
+
 private:
     Memory _memory;
     StreamInputCallbacks _inputCbs;
 
     enum
     {
+        kStart,
         kOpenRootList,
         kReadRootList,
         kOpenMediaList,
         kReadMediaList,
+        kOpenRefreshList,
+        kReadRefreshList,
         kDownloadSegment,
         kOpenSegment,
         kReadSegment,
@@ -72,22 +153,64 @@ private:
     uint32_t _inputRequestHandle;
     uintptr_t _inputResourceHandle;
     Buffer _inputBuffer;
+    size_t _inputRemaining;
+
+    //  playlists are parsed in chunks as they are read
+    static const size_t kPlaylistChunkSize = 16*1024;
+    HLSMasterPlaylistParser _masterParser;
+    HLSPlaylistParser _mediaParser;
 
     HLSMasterPlaylist _masterPlaylist;
     HLSMasterPlaylist::Playlists::iterator _toParsePlaylist;
     HLSMasterPlaylist::Playlists::const_iterator _toPlayPlaylist;
-    std::string _rootUrl;
+    std::string _url;
+    std::string _segmentUrl;        // url of the segment being opened
 
     int _playlistSegmentIndex;
 
+    //  live playlist refresh.  the sequence number of the next segment to
+    //  play locates it again once the playlist window has moved.
+    uint32_t _refreshSeqNo;
+    uint64_t _nextRefreshUs;
+    //  when the held playlist was last requested, or kNoTime if unknown.
+    //  delta updates are only requested within half of CAN-SKIP-UNTIL of it
+    //  (RFC 8216bis 6.3.7).
+    static const uint64_t kNoTime = ~0ull;
+    uint64_t _playlistLoadUs;
+    uint64_t _refreshRequestUs;
+    bool _refreshFull;              // next refresh must not be a delta
+    //  hash of the last parsed refresh body, and the playlist it belongs to
+    uint64_t _refreshHash;
+    int _refreshHashPlaylist;
+    RefreshStats _refreshStats;
+
+    size_t _memoryBudget;
+    size_t _segmentSizeEstimate;    // size of the last segment opened
+
+    uint32_t _maxBandwidth;         // 0 plays the first variant
+    uint32_t _familyMask;
+
     Buffer _videoBuffer;
     Buffer _audioBuffer;
     cinekav::mpegts::Demuxer _demuxer;
-    uint8_t _audioESIndex;          // 0x1  - 0x7f
-    uint8_t _videoESIndex;          // 0x80 - 0xff
+    uint8_t _audioESIndex;          // 0x80 - 0xff
+    uint8_t _videoESIndex;          // 0x1  - 0x7f
 
     int _bufferCount;
 
+    //  elementary stream buffers are pooled blocks of the video and audio
+    //  buffers.  each stream buffer slot holds a reference to its block.
+    using Blocks = std::vector<BlockPool::Block*,
+                               std_allocator<BlockPool::Block*>>;
+    BlockPool _videoPool;
+    BlockPool _audioPool;
+    Blocks _videoBlocks;
+    Blocks _audioBlocks;
+
+    Buffer acquireSlotBuffer(BlockPool& pool, Blocks& blocks, int idx);
+    static bool isSlotWritable(const Blocks& blocks, int idx);
+    void releaseSlotBlocks();
+
     using EStreams = std::vector<cinekav::ElementaryStream,
                                  std_allocator<cinekav::ElementaryStream>>;
     EStreams _audioStreams;
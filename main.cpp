@@ -1,3 +1,693 @@
-int main(int argc, const char* argv[]) {
-  return 0;
-}
\ No newline at end of file
+/**
+ *  @file       main.cpp
+ *  @brief      Demux benchmark and inspection tool
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#include "mpegts.hpp"
+#include "hlsplaylist.hpp"
+#include "avcodecs.hpp"
+#include "avcpu.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace cinekav;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+struct Options
+{
+    int repeat = 5;
+    int warmup = 1;
+    bool json = false;
+    bool gather = false;        // demux by reference instead of copying
+    bool scalar = false;        // bind the scalar kernels only
+};
+
+//  An input is either a single TS file, or the segments of an HLS media
+//  playlist loaded into memory.
+struct Segment
+{
+    std::string url;
+    std::vector<uint8_t> data;
+};
+
+struct Input
+{
+    std::string name;
+    std::vector<Segment> segments;
+    uint64_t bytes = 0;
+    uint64_t durationUs = 0;        // 0 if unknown
+    double playlistMs = 0.0;
+    double loadMs = 0.0;
+};
+
+//  Totals for one stream type across all segments of an iteration
+struct TypeStats
+{
+    uint32_t streams = 0;
+    uint64_t bytes = 0;
+    uint64_t accessUnits = 0;
+};
+
+struct Phase
+{
+    double totalMs = 0.0;
+    double bestMs = 0.0;
+    double worstMs = 0.0;
+
+    void add(double ms, bool first)
+    {
+        totalMs += ms;
+        bestMs = first ? ms : std::min(bestMs, ms);
+        worstMs = first ? ms : std::max(worstMs, ms);
+    }
+};
+
+struct Iteration
+{
+    double demuxMs = 0.0;
+    double consumeMs = 0.0;
+    TypeStats types[256];
+    uint64_t checksum = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//  Input loading
+
+bool readFile(const std::string& path, uint64_t offset, uint32_t length,
+              std::vector<uint8_t>& out)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    bool ok = true;
+    if (!length)
+    {
+        ok = !fseek(fp, 0, SEEK_END);
+        long sz = ftell(fp);
+        ok = ok && sz >= 0 && !fseek(fp, 0, SEEK_SET);
+        length = ok ? (uint32_t)sz : 0;
+        offset = 0;
+    }
+    else
+    {
+        ok = !fseek(fp, (long)offset, SEEK_SET);
+    }
+    if (ok)
+    {
+        out.resize(length);
+        ok = fread(out.data(), 1, length, fp) == length;
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool isDirectory(const std::string& path)
+{
+    struct stat st;
+    return !stat(path.c_str(), &st) && S_ISDIR(st.st_mode);
+}
+
+bool hasExtension(const std::string& name, const char* ext)
+{
+    size_t len = strlen(ext);
+    return name.size() > len &&
+           !strcasecmp(name.c_str() + name.size() - len, ext);
+}
+
+bool isMasterPlaylist(const std::vector<uint8_t>& text)
+{
+    static const char kTag[] = "#EXT-X-STREAM-INF";
+    return std::search(text.begin(), text.end(),
+                       kTag, kTag + sizeof(kTag) - 1) != text.end();
+}
+
+//  Loads the segments of a media playlist.  A master playlist's highest
+//  bandwidth variant is loaded instead.
+bool loadPlaylist(const std::string& path, Input& input)
+{
+    auto start = Clock::now();
+
+    std::vector<uint8_t> text;
+    if (!readFile(path, 0, 0, text))
+    {
+        fprintf(stderr, "%s: unable to read playlist\n", path.c_str());
+        return false;
+    }
+    std::string mediaPath = path;
+    if (isMasterPlaylist(text))
+    {
+        HLSMasterPlaylist master;
+        HLSMasterPlaylistParser parser(path);
+        parser.feed(master, reinterpret_cast<const char*>(text.data()),
+                    text.size());
+        parser.finish(master);
+        //  variants are only marked available once their playlist loads
+        for (auto& stream : master)
+            stream.info.available = true;
+        int index = master.selectByBandwidth(UINT32_MAX, ~0u);
+        if (index < 0)
+        {
+            fprintf(stderr, "%s: no variants\n", path.c_str());
+            return false;
+        }
+        mediaPath = master.streamAt(index)->playlist.uri();
+        if (!readFile(mediaPath, 0, 0, text))
+        {
+            fprintf(stderr, "%s: unable to read playlist\n", mediaPath.c_str());
+            return false;
+        }
+    }
+
+    HLSPlaylist playlist(mediaPath);
+    HLSPlaylistParser parser;
+    parser.feed(playlist, reinterpret_cast<const char*>(text.data()),
+                text.size());
+    parser.finish(playlist);
+    input.durationUs = playlist.durationUs();
+    input.playlistMs = elapsedMs(start, Clock::now());
+
+    start = Clock::now();
+    input.segments.resize(playlist.segmentCount());
+    for (int i = 0; i < playlist.segmentCount(); ++i)
+    {
+        const HLSPlaylist::Segment* segment = playlist.segmentAt(i);
+        Segment& out = input.segments[i];
+        playlist.appendSegmentUrl(*segment, out.url);
+        if (!readFile(out.url, segment->byteOffset, segment->byteLength,
+                      out.data))
+        {
+            fprintf(stderr, "%s: unable to read segment\n", out.url.c_str());
+            return false;
+        }
+        input.bytes += out.data.size();
+    }
+    input.loadMs = elapsedMs(start, Clock::now());
+    return true;
+}
+
+//  Loads a directory's playlist, or all of its TS files in name order if it
+//  has none.  A master playlist is preferred over media playlists.
+bool loadDirectory(const std::string& path, Input& input)
+{
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+    {
+        fprintf(stderr, "%s: unable to open directory\n", path.c_str());
+        return false;
+    }
+    std::vector<std::string> playlists;
+    std::vector<std::string> segments;
+    while (struct dirent* entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (hasExtension(name, ".m3u8"))
+            playlists.push_back(path + "/" + name);
+        else if (hasExtension(name, ".ts"))
+            segments.push_back(path + "/" + name);
+    }
+    closedir(dir);
+    std::sort(playlists.begin(), playlists.end());
+    std::sort(segments.begin(), segments.end());
+
+    if (!playlists.empty())
+    {
+        std::string chosen = playlists.front();
+        std::vector<uint8_t> text;
+        for (auto& playlist : playlists)
+        {
+            if (readFile(playlist, 0, 0, text) && isMasterPlaylist(text))
+            {
+                chosen = playlist;
+                break;
+            }
+        }
+        return loadPlaylist(chosen, input);
+    }
+
+    auto start = Clock::now();
+    input.segments.resize(segments.size());
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        Segment& out = input.segments[i];
+        out.url = segments[i];
+        if (!readFile(out.url, 0, 0, out.data))
+        {
+            fprintf(stderr, "%s: unable to read segment\n", out.url.c_str());
+            return false;
+        }
+        input.bytes += out.data.size();
+    }
+    input.loadMs = elapsedMs(start, Clock::now());
+    return true;
+}
+
+bool loadInput(const std::string& path, Input& input)
+{
+    input.name = path;
+    bool ok;
+    if (isDirectory(path))
+    {
+        ok = loadDirectory(path, input);
+    }
+    else if (hasExtension(path, ".m3u8"))
+    {
+        ok = loadPlaylist(path, input);
+    }
+    else
+    {
+        auto start = Clock::now();
+        input.segments.resize(1);
+        input.segments[0].url = path;
+        ok = readFile(path, 0, 0, input.segments[0].data);
+        if (!ok)
+            fprintf(stderr, "%s: unable to read file\n", path.c_str());
+        input.bytes = input.segments[0].data.size();
+        input.loadMs = elapsedMs(start, Clock::now());
+    }
+    if (ok && input.segments.empty())
+    {
+        fprintf(stderr, "%s: no segments\n", path.c_str());
+        ok = false;
+    }
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//  Demuxing
+
+const char* familyName(codecs::Family family)
+{
+    switch (family)
+    {
+    case codecs::kFamily_MPEG1Audio:    return "MPEG-1 Audio";
+    case codecs::kFamily_MPEG2Audio:    return "MPEG-2 Audio";
+    case codecs::kFamily_AAC:           return "AAC";
+    case codecs::kFamily_AVC:           return "H.264";
+    case codecs::kFamily_HEVC:          return "H.265";
+    case codecs::kFamily_AC3:           return "AC-3";
+    case codecs::kFamily_EC3:           return "E-AC-3";
+    case codecs::kFamily_VP9:           return "VP9";
+    case codecs::kFamily_AV1:           return "AV1";
+    default:                            return "unknown";
+    }
+}
+
+//  FNV-1a, so output can be compared across builds and kernels
+uint64_t hashBytes(uint64_t hash, const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+const size_t kMaxStreams = 16;
+const size_t kInitialSlices = 64;
+
+//  Demuxes one segment into fresh elementary streams, then reads every
+//  access unit as a decoder would.  Streams without access units (audio) are
+//  read as a whole.
+mpegts::Demuxer::Result demuxSegment(const Segment& segment,
+                                     const Options& options, Iteration& it)
+{
+    ElementaryStream streams[kMaxStreams];
+    size_t streamCount = 0;
+    int bufferSize = (int)segment.data.size();
+
+    auto start = Clock::now();
+    mpegts::Demuxer demuxer(
+        [&](ElementaryStream::Type type, uint16_t progId) -> ElementaryStream*
+        {
+            if (streamCount == kMaxStreams)
+                return nullptr;
+            uint8_t index = (uint8_t)(streamCount + 1);
+            ElementaryStream& stream = streams[streamCount++];
+            if (options.gather)
+                stream = ElementaryStream(type, progId, index);
+            else
+                stream = ElementaryStream(Buffer(bufferSize), type, progId,
+                                          index);
+            return &stream;
+        },
+        [&](uint16_t progId, uint16_t index) -> ElementaryStream*
+        {
+            if (!index || index > streamCount)
+                return nullptr;
+            ElementaryStream& stream = streams[index-1];
+            return stream.programId() == progId ? &stream : nullptr;
+        },
+        [](uint16_t, uint16_t) {},
+        [](uint16_t, uint16_t, uint32_t) -> ElementaryStream*
+        {
+            //  stream buffers are as large as the segment
+            return nullptr;
+        });
+
+    Buffer input(const_cast<uint8_t*>(segment.data.data()), bufferSize);
+    auto result = demuxer.read(input);
+    auto demuxed = Clock::now();
+
+    //  grown when an access unit spans more slices, so it is hashed whole
+    std::vector<BufferSlice> slices(kInitialSlices);
+    for (size_t i = 0; i < streamCount; ++i)
+    {
+        ElementaryStream& stream = streams[i];
+        TypeStats& stats = it.types[stream.type()];
+        ++stats.streams;
+        stats.bytes += stream.gathered() ? stream.chain().size() :
+                                           stream.buffer().size();
+        stats.accessUnits += stream.accessUnitCount();
+
+        if (stream.accessUnitCount())
+        {
+            for (size_t au = 0; au < stream.accessUnitCount(); ++au)
+            {
+                const ESAccessUnit& unit = *stream.accessUnit(au);
+                size_t count = stream.gatherAccessUnit(unit, slices.data(),
+                                                       slices.size());
+                if (count > slices.size())
+                {
+                    slices.resize(count);
+                    count = stream.gatherAccessUnit(unit, slices.data(),
+                                                    slices.size());
+                }
+                for (size_t s = 0; s < count; ++s)
+                {
+                    it.checksum = hashBytes(it.checksum, slices[s].data,
+                                            slices[s].size);
+                }
+            }
+        }
+        else if (stream.gathered())
+        {
+            const BufferChain& chain = stream.chain();
+            for (size_t s = 0; s < chain.sliceCount(); ++s)
+            {
+                it.checksum = hashBytes(it.checksum, chain.slice(s).data,
+                                        chain.slice(s).size);
+            }
+        }
+        else
+        {
+            it.checksum = hashBytes(it.checksum, stream.buffer().head(),
+                                    stream.buffer().size());
+        }
+    }
+    auto consumed = Clock::now();
+
+    it.demuxMs += elapsedMs(start, demuxed);
+    it.consumeMs += elapsedMs(demuxed, consumed);
+    return result;
+}
+
+bool runIteration(const Input& input, const Options& options, Iteration& it)
+{
+    it = Iteration();
+    it.checksum = 14695981039346656037ull;
+    for (auto& segment : input.segments)
+    {
+        auto result = demuxSegment(segment, options, it);
+        if (result != mpegts::Demuxer::kComplete)
+        {
+            fprintf(stderr, "%s: demux failed (result %d)\n",
+                    segment.url.c_str(), (int)result);
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//  Reporting
+
+struct Report
+{
+    const Input* input;
+    int iterations;
+    Phase demux;
+    Phase consume;
+    Iteration last;             // stream totals, identical each iteration
+};
+
+double perSecond(double count, double ms)
+{
+    return ms > 0.0 ? count * 1000.0 / ms : 0.0;
+}
+
+std::string featureNames(uint32_t features)
+{
+    std::string names;
+    if (features & cpu::kSSE2)
+        names += " sse2";
+    if (features & cpu::kSSE42)
+        names += " sse4.2";
+    if (features & cpu::kAVX2)
+        names += " avx2";
+    if (features & cpu::kAVX512)
+        names += " avx512";
+    return names.empty() ? std::string("scalar") : names.substr(1);
+}
+
+void printText(const Report& report, const Options& options)
+{
+    const Input& input = *report.input;
+    double demuxMs = report.demux.totalMs / report.iterations;
+    double consumeMs = report.consume.totalMs / report.iterations;
+    uint64_t packets = input.bytes / mpegts::kDefaultPacketSize;
+
+    printf("%s\n", input.name.c_str());
+    printf("  %zu segments, %.3f MB", input.segments.size(),
+           input.bytes / 1e6);
+    if (input.durationUs)
+        printf(", %.3f s", input.durationUs / 1e6);
+    printf(", %s, kernels: %s, %d iterations\n",
+           options.gather ? "gathered" : "copied",
+           featureNames(cpu::boundFeatures()).c_str(), report.iterations);
+
+    printf("  %-10s %10s %10s %10s\n", "phase", "mean ms", "best ms",
+           "worst ms");
+    printf("  %-10s %10.3f\n", "playlist", input.playlistMs);
+    printf("  %-10s %10.3f\n", "load", input.loadMs);
+    printf("  %-10s %10.3f %10.3f %10.3f\n", "demux", demuxMs,
+           report.demux.bestMs, report.demux.worstMs);
+    printf("  %-10s %10.3f %10.3f %10.3f\n", "consume", consumeMs,
+           report.consume.bestMs, report.consume.worstMs);
+
+    printf("  %-14s %7s %12s %10s %10s %12s\n", "stream", "count",
+           "bytes", "AUs", "MB/s", "AUs/s");
+    for (int type = 0; type < 256; ++type)
+    {
+        const TypeStats& stats = report.last.types[type];
+        if (!stats.streams)
+            continue;
+        char label[32];
+        snprintf(label, sizeof(label), "0x%02x %s", type,
+                 familyName(codecs::kStreamTypeTable[type].family));
+        printf("  %-14s %7u %12llu %10llu %10.2f %12.0f\n", label,
+               stats.streams, (unsigned long long)stats.bytes,
+               (unsigned long long)stats.accessUnits,
+               perSecond(stats.bytes / 1e6, demuxMs),
+               perSecond((double)stats.accessUnits, demuxMs));
+    }
+    printf("  demux: %.2f MB/s, %.0f packets/s", perSecond(input.bytes / 1e6,
+           demuxMs), perSecond((double)packets, demuxMs));
+    if (input.durationUs && demuxMs > 0.0)
+        printf(", %.0fx realtime", input.durationUs / (demuxMs * 1000.0));
+    printf("\n  checksum: %016llx\n", (unsigned long long)report.last.checksum);
+}
+
+void printJsonString(const std::string& str)
+{
+    putchar('"');
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if ((unsigned char)c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+void printJsonPhase(const char* name, const Phase& phase, int iterations)
+{
+    printf("\"%s\": { \"mean_ms\": %.4f, \"best_ms\": %.4f, "
+           "\"worst_ms\": %.4f }", name, phase.totalMs / iterations,
+           phase.bestMs, phase.worstMs);
+}
+
+void printJson(const Report& report, const Options& options, bool first)
+{
+    const Input& input = *report.input;
+    double demuxMs = report.demux.totalMs / report.iterations;
+    uint64_t packets = input.bytes / mpegts::kDefaultPacketSize;
+
+    printf("%s\n  {\n    \"input\": ", first ? "" : ",");
+    printJsonString(input.name);
+    printf(",\n    \"segments\": %zu,\n    \"bytes\": %llu,\n"
+           "    \"duration_us\": %llu,\n    \"mode\": \"%s\",\n"
+           "    \"kernels\": \"%s\",\n    \"iterations\": %d,\n",
+           input.segments.size(), (unsigned long long)input.bytes,
+           (unsigned long long)input.durationUs,
+           options.gather ? "gathered" : "copied",
+           featureNames(cpu::boundFeatures()).c_str(), report.iterations);
+    printf("    \"phases\": {\n      \"playlist\": { \"mean_ms\": %.4f },\n"
+           "      \"load\": { \"mean_ms\": %.4f },\n      ",
+           input.playlistMs, input.loadMs);
+    printJsonPhase("demux", report.demux, report.iterations);
+    printf(",\n      ");
+    printJsonPhase("consume", report.consume, report.iterations);
+    printf("\n    },\n    \"mb_per_s\": %.4f,\n    \"packets_per_s\": %.1f,\n",
+           perSecond(input.bytes / 1e6, demuxMs),
+           perSecond((double)packets, demuxMs));
+    printf("    \"streams\": [");
+    bool firstType = true;
+    for (int type = 0; type < 256; ++type)
+    {
+        const TypeStats& stats = report.last.types[type];
+        if (!stats.streams)
+            continue;
+        printf("%s\n      { \"stream_type\": %d, \"codec\": \"%s\", "
+               "\"count\": %u, \"bytes\": %llu, \"access_units\": %llu, "
+               "\"mb_per_s\": %.4f, \"aus_per_s\": %.1f }",
+               firstType ? "" : ",", type,
+               familyName(codecs::kStreamTypeTable[type].family),
+               stats.streams, (unsigned long long)stats.bytes,
+               (unsigned long long)stats.accessUnits,
+               perSecond(stats.bytes / 1e6, demuxMs),
+               perSecond((double)stats.accessUnits, demuxMs));
+        firstType = false;
+    }
+    printf("\n    ],\n    \"checksum\": \"%016llx\"\n  }",
+           (unsigned long long)report.last.checksum);
+}
+
+void printUsage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [options] <file.ts | playlist.m3u8 | hls directory>...\n"
+        "  --repeat N     timed iterations per input (default 5)\n"
+        "  --warmup N     untimed iterations per input (default 1)\n"
+        "  --json         write results as JSON\n"
+        "  --gather       demux payload by reference instead of copying\n"
+        "  --scalar       use the scalar kernels only\n", name);
+}
+
+bool parseCount(const char* arg, int* out)
+{
+    char* end;
+    long value = arg ? strtol(arg, &end, 10) : -1;
+    if (!arg || *end || value < 0 || value > 1000000)
+        return false;
+    *out = (int)value;
+    return true;
+}
+
+} /* anonymous namespace */
+
+int main(int argc, const char* argv[])
+{
+    Options options;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        bool ok = true;
+        if (!strcmp(arg, "--repeat"))
+            ok = parseCount(i+1 < argc ? argv[++i] : nullptr, &options.repeat) &&
+                 options.repeat > 0;
+        else if (!strcmp(arg, "--warmup"))
+            ok = parseCount(i+1 < argc ? argv[++i] : nullptr, &options.warmup);
+        else if (!strcmp(arg, "--json"))
+            options.json = true;
+        else if (!strcmp(arg, "--gather"))
+            options.gather = true;
+        else if (!strcmp(arg, "--scalar"))
+            options.scalar = true;
+        else if (arg[0] == '-')
+            ok = false;
+        else
+            paths.push_back(arg);
+        if (!ok)
+        {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (paths.empty())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    cpu::bindKernels(options.scalar ? 0 : ~0u);
+
+    if (options.json)
+        printf("[");
+    int status = 0;
+    bool first = true;
+    for (auto& path : paths)
+    {
+        Input input;
+        if (!loadInput(path, input))
+        {
+            status = 1;
+            continue;
+        }
+
+        Report report;
+        report.input = &input;
+        report.iterations = options.repeat;
+        Iteration it;
+        bool ok = true;
+        for (int i = 0; ok && i < options.warmup; ++i)
+            ok = runIteration(input, options, it);
+        for (int i = 0; ok && i < options.repeat; ++i)
+        {
+            ok = runIteration(input, options, it);
+            report.demux.add(it.demuxMs, i == 0);
+            report.consume.add(it.consumeMs, i == 0);
+        }
+        if (!ok)
+        {
+            status = 1;
+            continue;
+        }
+        report.last = it;
+
+        if (options.json)
+            printJson(report, options, first);
+        else
+            printText(report, options);
+        first = false;
+    }
+    if (options.json)
+        printf("\n]\n");
+    return status;
+}
@@ -9,6 +9,7 @@
  */
 
 #include "mpegts.hpp"
+#include "avcodecs.hpp"
 
 #include <cstdlib>
 #include <algorithm>
@@ -16,28 +17,6 @@
 
 namespace cinekav { namespace mpegts {
 
-//  0x0f        = AAC
-//  0x1b        = H.264 (AVC1)
-//
-static uint8_t kSupportedStreamFormats[16][16] = {
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
-    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
-};
-
 ////////////////////////////////////////////////////////////////////////////////
 
 struct Demuxer::BufferNode
@@ -78,7 +57,11 @@ Demuxer::Demuxer(const CreateStreamFn& createStreamFn,
     _getStreamFn(getStreamFn),
     _finalStreamFn(finalStreamFn),
     _overflowStreamFn(overflowStreamFn),
-    _headBuffer(nullptr)
+    _headBuffer(nullptr),
+    _inPlace(false),
+    _pendingNode(nullptr),
+    _pendingStart(false),
+    _pendingCount(0)
 {
     reset();
 }
@@ -91,39 +74,41 @@ Demuxer::~Demuxer()
 #if CINEK_AVLIB_IOSTREAMS
 auto Demuxer::read(std::basic_istream<char> &istr) -> Result
 {
+    //  with streaming, we need to manage our own buffer instead of relying
+    //  on an application supplied buffer
+    if (_buffer.capacity() < kDefaultPacketSize)
+    {
+        _buffer = Buffer(kDefaultPacketSize, _memory);
+    }
+    if (!_buffer)
+        return kOutOfMemory;
+
+    _inPlace = false;
     return readInternal(
-        [&istr](Buffer& target) -> int {
-            return target.pushBytesFromStream(istr, kDefaultPacketSize);
+        [this, &istr](int* cnt) -> const uint8_t* {
+            _buffer.reset();
+            *cnt = _buffer.pushBytesFromStream(istr, kDefaultPacketSize);
+            return _buffer.head();
         });
 }
 #endif
 
 auto Demuxer::read(Buffer& in) -> Result
 {
+    //  packets are parsed in place within the application's buffer, so
+    //  payload is only copied (if at all) into the elementary streams.
+    _inPlace = true;
     return readInternal(
-        [&in](Buffer& target) -> int {
-            int cnt = -1;
-            target.pullBytesFrom(in, kDefaultPacketSize, &cnt);
-            return cnt;
+        [&in](int* cnt) -> const uint8_t* {
+            const uint8_t* packet = in.head();
+            *cnt = std::min(in.size(), kDefaultPacketSize);
+            in.skip(*cnt);
+            return packet;
         });
 }
 
-auto Demuxer::readInternal(const std::function<int(Buffer&)>& inFn) -> Result
+auto Demuxer::readInternal(const PacketFn& inFn) -> Result
 {
- //  with streaming, we need to manage our own buffer instead of relying
-    //  on an application supplied buffer
-    if (_buffer.capacity() < kDefaultPacketSize)
-    {
-        _buffer = Buffer(kDefaultPacketSize, _memory);
-    }
-    else
-    {
-        _buffer.reset();
-    }
-
-    if (!_buffer)
-        return kOutOfMemory;
-
     //  restart demuxer
     reset();
 
@@ -131,10 +116,9 @@ auto Demuxer::readInternal(const std::function<int(Buffer&)>& inFn) -> Result
 
     while (result == kContinue)
     {
-        _buffer.reset();
-
         //  read a single minimum-sized ts packet
-        int cnt = inFn(_buffer);
+        int cnt = 0;
+        const uint8_t* packet = inFn(&cnt);
 
         if (cnt == 0)
         {
@@ -150,10 +134,16 @@ auto Demuxer::readInternal(const std::function<int(Buffer&)>& inFn) -> Result
         }
         else
         {
-            result = parsePacket();
+            result = parsePacket(packet);
         }
     }
 
+    if (result == kComplete)
+    {
+        result = flushPayload();
+        if (result == kContinue)
+            result = kComplete;
+    }
     if (result == kComplete)
     {
         finalizeStreams();
@@ -179,6 +169,8 @@ void Demuxer::reset()
 {
     _syncCnt = 0;
     _skipCnt = 0;
+    _pendingNode = nullptr;
+    _pendingCount = 0;
     while (_headBuffer)
     {
         BufferNode* next = _headBuffer->next;
@@ -187,24 +179,21 @@ void Demuxer::reset()
     }
 }
 
-auto Demuxer::parsePacket() -> Result
+auto Demuxer::parsePacket(const uint8_t* packet) -> Result
 {
-    uint8_t byte;
-    uint16_t word;
+    //  the caller guarantees a full packet, which covers the 4 byte header
+    ByteReader in(packet, kDefaultPacketSize);
+    uint32_t header = in.u32();
 
     //  TS sync check
-    byte = _buffer.pullByte();
-    if (byte != 0x47)
+    if ((header >> 24) != 0x47)
         return kInvalidPacket;
 
     ++_syncCnt;
 
-    //  parse the remaining 3 bytes from the header
-    word = _buffer.pullUInt16();
-
-    uint16_t pid = word & 0x1fff;
-    bool payloadUnitStart = word & 0x4000;
-    bool transportError = word & 0x8000;
+    uint16_t pid = (header >> 8) & 0x1fff;
+    bool payloadUnitStart = header & 0x00400000;
+    bool transportError = header & 0x00800000;
     //  todo: priority?
 
     if (transportError)
@@ -213,11 +202,9 @@ auto Demuxer::parsePacket() -> Result
         return kContinue;
     }
 
-    byte = _buffer.pullByte();
-
-    bool adaptationFieldExists = byte & 0x20;
-    bool hasPayload = byte & 0x10;
-    //int continuityCounter = byte & 0x0f;
+    bool adaptationFieldExists = header & 0x20;
+    bool hasPayload = header & 0x10;
+    //int continuityCounter = header & 0x0f;
 
     if (pid == kPID_Null || !hasPayload)
     {
@@ -227,42 +214,52 @@ auto Demuxer::parsePacket() -> Result
     //  parse the adaptation field - todo
     if (adaptationFieldExists)
     {
-        byte = _buffer.pullByte();
-        _buffer.skip(byte);
-        if (_buffer.overflow())
+        if (!in.has(1) || !in.trySkip(in.u8()))
             return kInvalidPacket;
     }
 
     BufferNode* pidNode = createOrFindBuffer(pid);
     if (!pidNode)
         return kOutOfMemory;
+
+    //  a run of queued payload ends at a packet from another PID
+    if (_pendingCount && pidNode != _pendingNode)
+    {
+        Result result = flushPayload();
+        if (result != kContinue)
+            return result;
+    }
     
     if (pidNode->pid == kPID_PAT || pidNode->type == BufferNode::kPSI)
     {
-        return parsePayloadPSI(*pidNode, payloadUnitStart);
+        return parsePayloadPSI(*pidNode, in, payloadUnitStart);
     }
     else if (pidNode->type == BufferNode::kPES)
     {
-        return parsePayloadPES(*pidNode, payloadUnitStart);
+        return parsePayloadPES(*pidNode, in, payloadUnitStart);
     }
 
     return kContinue;
 }
 
-auto Demuxer::parsePayloadPSI(BufferNode& pidBuffer, bool start) -> Result
+auto Demuxer::parsePayloadPSI
+(
+    BufferNode& pidBuffer,
+    ByteReader& in,
+    bool start
+) -> Result
 {
-    int payloadSize = _buffer.size();
     if (start)
     {
         //  the pointer field used to offset the start of our table data, or 0.
-        uint8_t byte = _buffer.pullByte();
-        _buffer.skip(byte);
-        if (_buffer.overflow())
+        if (!in.has(1) || !in.trySkip(in.u8()))
             return kInvalidPacket;
 
         //  parse the table header
-        uint8_t tableId = _buffer.pullByte();
-        uint16_t sectionHeader = _buffer.pullUInt16();
+        if (!in.has(3))
+            return kInvalidPacket;
+        uint8_t tableId = in.u8();
+        uint16_t sectionHeader = in.u16();
         if ((sectionHeader & 0x3000)!=0x3000)
             return kInvalidPacket;
 
@@ -282,12 +279,12 @@ auto Demuxer::parsePayloadPSI(BufferNode& pidBuffer, bool start) -> Result
     if (!pidBuffer.buffer)
         return kInternalError;
 
+    int payloadSize = (int)in.size();
     if (payloadSize > pidBuffer.buffer.available())
         payloadSize = pidBuffer.buffer.available();
-    int pulled = 0;
-    pidBuffer.buffer.pullBytesFrom(_buffer, payloadSize, &pulled);
-    if (pulled != payloadSize)
+    if (pidBuffer.buffer.pushBytes(in.head(), payloadSize) != payloadSize)
         return kInternalError;
+    in.skip(payloadSize);
 
     if (pidBuffer.buffer.available())
         return kContinue;   // expecting more data
@@ -295,16 +292,18 @@ auto Demuxer::parsePayloadPSI(BufferNode& pidBuffer, bool start) -> Result
     if (pidBuffer.psi.hasSectionSyntax)
     {
         // iterate through all table entries
-        Buffer& buffer = pidBuffer.buffer;
-        uint16_t programId = buffer.pullUInt16();
-        uint8_t byte = buffer.pullByte();
+        ByteReader section(pidBuffer.buffer);
+        if (!section.has(5 + 4))
+            return kInvalidPacket;
+        uint16_t programId = section.u16();
+        uint8_t byte = section.u8();
         if ((byte & 0xc0)!=0xc0)
             return kInvalidPacket;
         if ((byte & 0x01)!=0x01)
             return kUnsupportedTable;
-        //uint8_t sectionStart = buffer.pullByte();
-        //uint8_t sectionEnd = buffer.pullByte();
-        buffer.skip(2);
+        //uint8_t sectionStart = section.u8();
+        //uint8_t sectionEnd = section.u8();
+        section.skip(2);
         
         Result parseResult = kContinue;
         
@@ -313,16 +312,16 @@ auto Demuxer::parsePayloadPSI(BufferNode& pidBuffer, bool start) -> Result
         case kPAT_Program_Assoc_Table:
             {
                 //  4 byte PAT entry
-                int numPrograms = (buffer.size() - 4) / 4;
+                int numPrograms = (int)(section.size() - 4) / 4;
                 for (int i = 0; i < numPrograms && parseResult == kContinue; ++i)
                 {
-                    parseResult = parseSectionPAT(pidBuffer);
+                    parseResult = parseSectionPAT(section);
                 }
             }
             break;
         case kPAT_Program_Map_Table:
             {
-                parseResult = parseSectionPMT(pidBuffer, programId);
+                parseResult = parseSectionPMT(section, programId);
             }
             break;
         default:
@@ -330,9 +329,11 @@ auto Demuxer::parsePayloadPSI(BufferNode& pidBuffer, bool start) -> Result
             break;
         }
    
-        assert(buffer.size() == 4);
-        //uint32_t crc32 = buffer.pullUInt32();
-        buffer.skip(4); // todo: CRC check?
+        //  a corrupt section can leave too few or too many bytes for the CRC
+        if (section.size() != 4)
+            return kInvalidPacket;
+        //uint32_t crc32 = section.u32();
+        section.skip(4); // todo: CRC check?
     }
     else
     {
@@ -344,12 +345,12 @@ auto Demuxer::parsePayloadPSI(BufferNode& pidBuffer, bool start) -> Result
 
 Demuxer::Result Demuxer::parseSectionPAT
 (
-    BufferNode& bufferNode
+    ByteReader& section
 )
 {
     //  register programs
-    uint16_t progNum = bufferNode.buffer.pullUInt16();
-    uint16_t progPid = bufferNode.buffer.pullUInt16();
+    uint16_t progNum = section.u16();
+    uint16_t progPid = section.u16();
     if ((progPid & 0xe000) != 0xe000)
         return kInvalidPacket;
     
@@ -369,14 +370,15 @@ Demuxer::Result Demuxer::parseSectionPAT
 
 Demuxer::Result Demuxer::parseSectionPMT
 (
-    BufferNode& bufferNode,
+    ByteReader& section,
     uint16_t programId
 )
 { 
-    Buffer& buffer = bufferNode.buffer;
     //  register programs
-    uint16_t pidPCR = buffer.pullUInt16();
-    uint16_t progInfoLength = buffer.pullUInt16();
+    if (!section.has(4))
+        return kInvalidPacket;
+    uint16_t pidPCR = section.u16();
+    uint16_t progInfoLength = section.u16();
     if ((pidPCR & 0xe000) != 0xe000)
         return kInvalidPacket;
     if ((progInfoLength & 0xf000) != 0xf000)
@@ -384,25 +386,27 @@ Demuxer::Result Demuxer::parseSectionPMT
     progInfoLength &= (0x03ff);
     
     //  todo: program descriptor parsing?
-    buffer.skip(progInfoLength);
+    if (!section.trySkip(progInfoLength))
+        return kInvalidPacket;
     
     //  parse elementary stream info
-    while (buffer.size() > 4)  // 4bytes, account for trailing crc32
+    while (section.size() > 4)  // 4bytes, account for trailing crc32
     {
-        uint8_t streamType = buffer.pullByte();
-        uint16_t pidStream = buffer.pullUInt16();
+        if (!section.has(5))
+            return kInvalidPacket;
+        uint8_t streamType = section.u8();
+        uint16_t pidStream = section.u16();
+        //  todo: ES descriptor bytes - skip for now.
+        uint16_t esDescLen = section.u16() & 0x03ff;
         if ((pidStream & 0xe000)!=0xe000)
             return kInvalidPacket;
+        if (!section.trySkip(esDescLen))
+            return kInvalidPacket;
         
         pidStream &= 0x1fff;
         
-        //  todo: ES descriptor bytes - skip for now.
-        uint16_t esDescLen = buffer.pullUInt16() & 0x03ff;
-        buffer.skip(esDescLen);
-        
-        uint8_t validStreamType =
-            kSupportedStreamFormats[(streamType & 0xf0)>>4][(streamType & 0x0f)];
-        if (validStreamType)
+        //  stream types are listed in the codec registry (avcodecs.hpp)
+        if (codecs::kStreamTypeTable[streamType].supported)
         {
             BufferNode* streamBuffer = createOrFindBuffer(pidStream);
             if (!streamBuffer)
@@ -427,20 +431,34 @@ Demuxer::Result Demuxer::parseSectionPMT
         }
     }
     
-    return buffer.size() == 4 ? kContinue :kInvalidPacket;
+    return section.size() == 4 ? kContinue :kInvalidPacket;
 }
 
 auto Demuxer::parsePayloadPES
 (
     BufferNode& bufferNode,
+    ByteReader& in,
     bool start
 ) -> Demuxer::Result
 {
+    auto& header = bufferNode.buffer;
+
+    //  payload continuing a PES packet is queued without a stream lookup
+    if (_inPlace && !start && !header.available())
+        return queuePayload(bufferNode, in, false);
+
+    //  queued payload belongs to the previous PES packet and its timestamps
+    Result result = flushPayload();
+    if (result != kContinue)
+        return result;
+
     ElementaryStream* stream = _getStreamFn(bufferNode.es.progId, bufferNode.es.index);
     if (!stream)
         return kContinue;
+    //  gathered payload references the input, which must persist
+    if (stream->gathered() && !_inPlace)
+        return kUnsupported;
 
-    auto& header = bufferNode.buffer;
     bool frameBegin = start;
 
     if (start)
@@ -451,16 +469,20 @@ auto Demuxer::parsePayloadPES
         //  0xbe = Padding stream
         //  0xbf = Private stream 2
         //  http://dvd.sourceforge.net/dvdinfo/pes-hdr.html
-        uint32_t startCode = _buffer.pullUInt32();
+        if (!in.has(6))
+            return kInvalidPacket;
+        uint32_t startCode = in.u32();
         if ((startCode & 0xffffff00) != 0x00000100)
             return kInvalidPacket;
         uint8_t streamId = (uint8_t)(startCode & 0x000000ff);
         stream->updateStreamId(streamId);
-        _buffer.skip(2);         // PES Packet Length (needed?)
+        in.skip(2);         // PES Packet Length (needed?)
         if (streamId != 0xbe && streamId != 0xbf)
         {
             //  parse the optional header
-            uint16_t headerFlags = _buffer.pullUInt16();
+            if (!in.has(3))
+                return kInvalidPacket;
+            uint16_t headerFlags = in.u16();
             
             if ((headerFlags & 0xc000) != 0x8000)
                 return kInvalidPacket;
@@ -469,7 +491,7 @@ auto Demuxer::parsePayloadPES
 
             bufferNode.es.hdrFlags = headerFlags;
             
-            uint32_t hdrLen = _buffer.pullByte();
+            uint32_t hdrLen = in.u8();
             if (hdrLen > 0)
             {
                 if (header.capacity() < hdrLen)
@@ -488,30 +510,33 @@ auto Demuxer::parsePayloadPES
     if (hdrLen)
     {
         frameBegin = true;
-        if (hdrLen > _buffer.size())
-            hdrLen = _buffer.size();
-        header.pullBytesFrom(_buffer, hdrLen, nullptr);
+        if (hdrLen > in.size())
+            hdrLen = in.size();
+        header.pushBytes(in.head(), hdrLen);
+        in.skip(hdrLen);
         hdrLen = header.available();
     
         //  header completely read from our input buffer?
         if (hdrLen == 0)
         {
             //  header to parse
-            
+            ByteReader fields(header);
             if ((bufferNode.es.hdrFlags & 0x00c0) == 0x0080)
             {
                 // parse pts
-                stream->updatePts(pullTimecodeFromBuffer(header));
+                if (!fields.has(5))
+                    return kInvalidPacket;
+                stream->updatePts(pullTimecode(fields));
                 
             }
             else if ((bufferNode.es.hdrFlags & 0x00c0) == 0x00c0)
             {
                 // parse pts, dts
-                stream->updatePtsDts
-                (
-                    pullTimecodeFromBuffer(header),
-                    pullTimecodeFromBuffer(header)
-                );
+                if (!fields.has(10))
+                    return kInvalidPacket;
+                uint64_t pts = pullTimecode(fields);
+                uint64_t dts = pullTimecode(fields);
+                stream->updatePtsDts(pts, dts);
             }
         }
         else
@@ -520,7 +545,68 @@ auto Demuxer::parsePayloadPES
         }
     }
 
-    uint32_t overflow = stream->appendPayload(_buffer, _buffer.size(), frameBegin);
+    if (_inPlace)
+        return queuePayload(bufferNode, in, frameBegin);
+
+    BufferSlice slice = { in.head(), in.size() };
+    return appendPayload(bufferNode, stream, &slice, 1, frameBegin);
+}
+
+auto Demuxer::queuePayload
+(
+    BufferNode& bufferNode,
+    ByteReader& in,
+    bool start
+) -> Demuxer::Result
+{
+    if (!in.size())
+        return kContinue;
+
+    if (_pendingCount == kMaxPendingSlices)
+    {
+        Result result = flushPayload();
+        if (result != kContinue)
+            return result;
+    }
+    if (!_pendingCount)
+    {
+        _pendingNode = &bufferNode;
+        _pendingStart = start;
+    }
+    BufferSlice& slice = _pending[_pendingCount++];
+    slice.data = in.head();
+    slice.size = in.size();
+    return kContinue;
+}
+
+auto Demuxer::flushPayload() -> Demuxer::Result
+{
+    if (!_pendingCount)
+        return kContinue;
+
+    size_t count = _pendingCount;
+    BufferNode& bufferNode = *_pendingNode;
+    _pendingCount = 0;
+    _pendingNode = nullptr;
+
+    ElementaryStream* stream = _getStreamFn(bufferNode.es.progId,
+                                            bufferNode.es.index);
+    if (!stream)
+        return kContinue;
+
+    return appendPayload(bufferNode, stream, _pending, count, _pendingStart);
+}
+
+auto Demuxer::appendPayload
+(
+    BufferNode& bufferNode,
+    ElementaryStream* stream,
+    const BufferSlice* slices,
+    size_t count,
+    bool start
+) -> Demuxer::Result
+{
+    uint32_t overflow = stream->appendPayload(slices, count, start);
     if (overflow)
     {
         //  allow the caller to give us a valid stream to read back into in the
@@ -529,7 +615,7 @@ auto Demuxer::parsePayloadPES
                                    overflow);
         if (stream)
         {
-            overflow = stream->appendPayload(_buffer, _buffer.size(), frameBegin);
+            overflow = stream->appendPayload(slices, count, start);
         }
         if (overflow || !stream)
             return kStreamOverflow;
@@ -569,13 +655,13 @@ auto Demuxer::createOrFindBuffer(uint16_t pid) -> Demuxer::BufferNode*
     return pidNode;
 }
 
-uint64_t Demuxer::pullTimecodeFromBuffer(Buffer& buffer)
+//  33-bit PTS/DTS: '001x' prefix, then 3, 15 and 15 bits each followed by a
+//  marker bit.  the caller checks that 5 bytes are available.
+uint64_t Demuxer::pullTimecode(ByteReader& in)
 {
-    uint64_t tc = buffer.pullByte() << 29;
-    tc |= (buffer.pullByte() << 22);
-    tc |= ((buffer.pullByte() & 0xfe) << 14);
-    tc |= (buffer.pullByte()) << 7;
-    tc |= ((buffer.pullByte() & 0xfe) >> 1);
+    uint64_t tc = (uint64_t)(in.u8() & 0x0e) << 29;
+    tc |= (uint64_t)(in.u16() & 0xfffe) << 14;
+    tc |= (in.u16() & 0xfffe) >> 1;
     return tc;
 }
 
@@ -77,13 +77,20 @@ namespace cinekav { namespace mpegts {
     #if CINEK_AVLIB_IOSTREAMS
         Result read(std::basic_istream<char>& istr);
     #endif
+        //  packets are parsed in place.  streams that gather payload
+        //  reference the buffer's memory, which must outlive their access
+        //  units.
         Result read(Buffer& buffer);
     
         void reset();
 
     private:
-        Result readInternal(const std::function<int(Buffer&)>& inFn);
-        //  buffer state
+        //  returns the next packet and its size in cnt, 0 at the end of input
+        //  or -1 on error.
+        using PacketFn = std::function<const uint8_t*(int* cnt)>;
+        Result readInternal(const PacketFn& inFn);
+        //  buffer state.  _buffer holds the current packet when reading
+        //  from a stream.
         Memory _memory;
         Buffer _buffer;
 
@@ -96,6 +103,15 @@ namespace cinekav { namespace mpegts {
         struct BufferNode;
 
         BufferNode* _headBuffer;
+        bool _inPlace;          // packets reference the caller's buffer
+
+        //  in place PES payload is queued while consecutive packets share a
+        //  PID, then appended as one run.
+        static const size_t kMaxPendingSlices = 64;
+        BufferNode* _pendingNode;
+        bool _pendingStart;
+        size_t _pendingCount;
+        BufferSlice _pending[kMaxPendingSlices];
         
         //  tracks the current state of parsing
         int _syncCnt;
@@ -105,13 +121,21 @@ namespace cinekav { namespace mpegts {
         Result readInternal();
         void finalizeStreams();
 
-        Result parsePacket();
-        Result parsePayloadPSI(BufferNode& bufferNode, bool start);
-        Result parseSectionPAT(BufferNode& bufferNode);
-        Result parseSectionPMT(BufferNode& bufferNode, uint16_t programId);
-        Result parsePayloadPES(BufferNode& bufferNode, bool start);
-
-        uint64_t pullTimecodeFromBuffer(Buffer& buffer);
+        Result parsePacket(const uint8_t* packet);
+        Result parsePayloadPSI(BufferNode& bufferNode, ByteReader& in,
+                               bool start);
+        Result parseSectionPAT(ByteReader& section);
+        Result parseSectionPMT(ByteReader& section, uint16_t programId);
+        Result parsePayloadPES(BufferNode& bufferNode, ByteReader& in,
+                               bool start);
+        Result queuePayload(BufferNode& bufferNode, ByteReader& in,
+                            bool start);
+        Result flushPayload();
+        Result appendPayload(BufferNode& bufferNode, ElementaryStream* stream,
+                             const BufferSlice* slices, size_t count,
+                             bool start);
+
+        uint64_t pullTimecode(ByteReader& in);
         
         BufferNode* createOrFindBuffer(uint16_t pid);
     };
@@ -0,0 +1,547 @@
+/**
+ *  @file       qoesim.cpp
+ *  @brief      Headless HLS playback simulator reporting quality of
+ *              experience
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#include "fileinput.hpp"
+#include "hlstream.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <string>
+
+using namespace cinekav;
+
+namespace {
+
+struct Options
+{
+    std::string url;
+    std::string root;
+    NetworkProfile network;
+    std::string traceName;
+    uint64_t startupUs = 0;             // buffered before the first frame
+    uint64_t resumeUs = 1000000;        // buffered before resuming a stall
+    uint64_t maxBufferUs = 30000000;    // buffered ahead of playback
+    uint32_t maxBandwidth = 0;          // variant limit, 0 for the first
+    uint64_t tickUs = 1000;
+    uint64_t durationUs = 3600000000ull;
+    size_t videoBufferSize = 8*1024*1024;
+    size_t audioBufferSize = 2*1024*1024;
+    bool json = false;
+};
+
+//  CPU time of the calling thread.  Segment reads happen on the input's
+//  worker, so this counts only the stream's own work.
+uint64_t threadCpuUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct Results
+{
+    enum { kEnded, kFailed, kTimedOut } end = kTimedOut;
+    bool started = false;
+    uint64_t ttffUs = 0;
+    uint32_t rebuffers = 0;
+    uint64_t rebufferUs = 0;
+    uint64_t playedUs = 0;              // media time presented
+    uint32_t frames = 0;
+    uint64_t videoBytes = 0;
+    uint32_t audioUnits = 0;
+    uint64_t sessionUs = 0;
+    uint64_t cpuUs = 0;
+    FileStreamInput::Stats input = FileStreamInput::Stats();
+};
+
+//  Presents video access units at their decode timestamps, the way a
+//  decoder consumes them.  Units are placed on a continuous media timeline
+//  as they are pulled, so timestamp wraps and discontinuities between
+//  segments play as one frame interval.
+class Player
+{
+public:
+    Player(const Options& options, Results& results) :
+        _options(options),
+        _results(results),
+        _state(kStartup),
+        _lastDts(0),
+        _mediaUs(0),
+        _frameUs(1000000 / 30),
+        _playStartUs(0),
+        _playStartMediaUs(0),
+        _firstMediaUs(0),
+        _nextMediaUs(0),
+        _nextDueUs(0),
+        _stallStartUs(0)
+    {
+    }
+
+    uint64_t bufferedUs() const
+    {
+        if (_queue.empty())
+            return 0;
+        return _queue.back().mediaUs - _queue.front().mediaUs + _frameUs;
+    }
+
+    void push(const ESAccessUnit& au)
+    {
+        if (!_queue.empty() || _results.frames)
+        {
+            //  90 kHz ticks, within 33 bits
+            uint64_t delta = (au.dts - _lastDts) & 0x1ffffffffull;
+            uint64_t deltaUs = delta * 100 / 9;
+            if (deltaUs && deltaUs <= 10000000)
+                _frameUs = deltaUs;
+            else
+                deltaUs = _frameUs;
+            _mediaUs += deltaUs;
+        }
+        _lastDts = au.dts;
+        _queue.push_back(Frame { _mediaUs, au.dataSize });
+    }
+
+    //  returns false once playback has finished
+    bool update(uint64_t nowUs, bool streamDone)
+    {
+        switch (_state)
+        {
+        case kStartup:
+            if (_queue.empty() ||
+                (bufferedUs() < threshold(_options.startupUs) && !streamDone))
+                break;
+            _results.started = true;
+            _results.ttffUs = nowUs;
+            play(nowUs, _queue.front().mediaUs, streamDone);
+            break;
+        case kStalled:
+            if (_queue.empty() ||
+                (bufferedUs() < threshold(_options.resumeUs) && !streamDone))
+                break;
+            _results.rebufferUs += nowUs - _stallStartUs;
+            play(nowUs, _nextMediaUs, streamDone);
+            break;
+        case kPlaying:
+            present(nowUs, streamDone);
+            break;
+        }
+
+        if (_queue.empty() && streamDone)
+        {
+            //  the last frame is shown for one interval
+            if (_state != kPlaying)
+            {
+                _results.sessionUs = nowUs;
+                return false;
+            }
+            _results.sessionUs = _nextDueUs;
+            return nowUs < _nextDueUs;
+        }
+        return true;
+    }
+
+    void finish(uint64_t nowUs)
+    {
+        if (_state == kStalled)
+            _results.rebufferUs += nowUs - _stallStartUs;
+        if (!_results.sessionUs)
+            _results.sessionUs = nowUs;
+    }
+
+private:
+    //  buffering can't wait for more than the player will pull
+    uint64_t threshold(uint64_t us) const
+    {
+        return us < _options.maxBufferUs ? us : _options.maxBufferUs;
+    }
+
+    //  playback resumes from where it stalled, so a gap before the next
+    //  unit still plays out
+    void play(uint64_t nowUs, uint64_t mediaUs, bool streamDone)
+    {
+        _state = kPlaying;
+        _playStartUs = nowUs;
+        _playStartMediaUs = mediaUs;
+        present(nowUs, streamDone);
+    }
+
+    void present(uint64_t nowUs, bool streamDone)
+    {
+        while (!_queue.empty())
+        {
+            const Frame& frame = _queue.front();
+            uint64_t dueUs = _playStartUs + frame.mediaUs - _playStartMediaUs;
+            if (dueUs > nowUs)
+                return;
+            //  gaps left by missing units count as played, as the last
+            //  frame stays on screen
+            if (!_results.frames)
+                _firstMediaUs = frame.mediaUs;
+            ++_results.frames;
+            _results.playedUs = frame.mediaUs + _frameUs - _firstMediaUs;
+            _results.videoBytes += frame.size;
+            _nextDueUs = dueUs + _frameUs;
+            _nextMediaUs = frame.mediaUs + _frameUs;
+            _queue.pop_front();
+        }
+        //  stalled once the next frame is due and hasn't arrived
+        if (nowUs >= _nextDueUs && !streamDone)
+        {
+            _state = kStalled;
+            _stallStartUs = _nextDueUs;
+            ++_results.rebuffers;
+        }
+    }
+
+    struct Frame
+    {
+        uint64_t mediaUs;
+        size_t size;
+    };
+
+    const Options& _options;
+    Results& _results;
+    enum { kStartup, kPlaying, kStalled } _state;
+    std::deque<Frame> _queue;
+    uint64_t _lastDts;
+    uint64_t _mediaUs;
+    uint64_t _frameUs;
+    uint64_t _playStartUs;
+    uint64_t _playStartMediaUs;
+    uint64_t _firstMediaUs;
+    uint64_t _nextMediaUs;              // media time at the next due time
+    uint64_t _nextDueUs;
+    uint64_t _stallStartUs;
+};
+
+bool simulate(const Options& options, Results& results)
+{
+    uint64_t nowUs = 0;
+    FileStreamInput input(options.root, options.network);
+    input.setClock([&nowUs]() { return nowUs; });
+
+    //  the stream's buffers are written by every segment, so they are
+    //  faulted in up front rather than during playback
+    AllocHints hints(64, AllocHints::kHugePages | AllocHints::kPrefault);
+    Player player(options, results);
+    {
+        HLStream stream(input.callbacks(),
+                        Buffer((int)options.videoBufferSize, hints),
+                        Buffer((int)options.audioBufferSize, hints),
+                        options.url.c_str());
+        stream.setVariantLimits(options.maxBandwidth);
+
+        for (; nowUs < options.durationUs; nowUs += options.tickUs)
+        {
+            uint64_t cpuStartUs = threadCpuUs();
+            stream.update();
+            while (player.bufferedUs() < options.maxBufferUs)
+            {
+                ESAccessUnit vau, aau;
+                int result = stream.pullEncodedData(&vau, &aau);
+                if (!result)
+                    break;
+                if (result & 0x01)
+                    player.push(vau);
+                if (result & 0x02)
+                    ++results.audioUnits;
+            }
+            results.cpuUs += threadCpuUs() - cpuStartUs;
+
+            bool done = stream.ended() || stream.failed();
+            if (!player.update(nowUs, done))
+            {
+                results.end = stream.failed() ? Results::kFailed :
+                                                Results::kEnded;
+                break;
+            }
+        }
+        player.finish(nowUs);
+    }
+    results.input = input.stats();
+    return results.started;
+}
+
+double perMediaSecond(double value, const Results& results)
+{
+    return results.playedUs ? value * 1000000.0 / results.playedUs : 0.0;
+}
+
+const char* endName(const Results& results)
+{
+    switch (results.end)
+    {
+    case Results::kEnded:       return "ended";
+    case Results::kFailed:      return "failed";
+    default:                    return "timed out";
+    }
+}
+
+void printText(const Options& options, const Results& results)
+{
+    const NetworkProfile& network = options.network;
+    printf("%s\n", options.url.c_str());
+    if (network.trace.empty())
+        printf("  network: unlimited");
+    else if (!options.traceName.empty())
+        printf("  network: trace %s (%zu steps)", options.traceName.c_str(),
+               network.trace.size());
+    else
+        printf("  network: %llu kbps",
+               (unsigned long long)network.trace[0].bitsPerSecond / 1000);
+    printf(", rtt %.1f ms, jitter %.1f ms\n", network.rttUs / 1000.0,
+           network.jitterUs / 1000.0);
+
+    if (results.started)
+        printf("  time to first frame  %10.1f ms\n", results.ttffUs / 1000.0);
+    else
+        printf("  time to first frame  %10s\n", "never");
+    printf("  rebuffers            %10u, %.1f ms (%.2f%% of playback)\n",
+           results.rebuffers, results.rebufferUs / 1000.0,
+           results.playedUs + results.rebufferUs ?
+               100.0 * results.rebufferUs /
+               (results.playedUs + results.rebufferUs) : 0.0);
+    printf("  played               %10.3f s, %u frames\n",
+           results.playedUs / 1000000.0, results.frames);
+    printf("  delivered bitrate    %10.1f kbps video, %.1f kbps from the "
+           "network\n", perMediaSecond(results.videoBytes * 8 / 1000.0,
+                                       results),
+           results.sessionUs ? results.input.bytesRead * 8000.0 /
+                               results.sessionUs : 0.0);
+    printf("  demux cpu            %10.3f ms per media second\n",
+           perMediaSecond(results.cpuUs / 1000.0, results));
+    printf("  input                %10u opens, %u reads, %u failed, %llu "
+           "bytes\n", results.input.opens, results.input.reads,
+           results.input.failedOpens + results.input.failedReads,
+           (unsigned long long)results.input.bytesRead);
+    printf("  session              %10.3f s, %s\n",
+           results.sessionUs / 1000000.0, endName(results));
+}
+
+void printJson(const Options& options, const Results& results)
+{
+    printf("{\n  \"url\": \"");
+    for (char c : options.url)
+    {
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if ((unsigned char)c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    printf("\",\n  \"end\": \"%s\",\n", endName(results));
+    if (results.started)
+        printf("  \"ttff_ms\": %.3f,\n", results.ttffUs / 1000.0);
+    else
+        printf("  \"ttff_ms\": null,\n");
+    printf("  \"rebuffers\": %u,\n  \"rebuffer_ms\": %.3f,\n"
+           "  \"played_s\": %.6f,\n  \"frames\": %u,\n"
+           "  \"audio_units\": %u,\n  \"video_kbps\": %.3f,\n"
+           "  \"network_kbps\": %.3f,\n  \"demux_cpu_ms_per_s\": %.4f,\n"
+           "  \"session_s\": %.6f,\n",
+           results.rebuffers, results.rebufferUs / 1000.0,
+           results.playedUs / 1000000.0, results.frames, results.audioUnits,
+           perMediaSecond(results.videoBytes * 8 / 1000.0, results),
+           results.sessionUs ? results.input.bytesRead * 8000.0 /
+                               results.sessionUs : 0.0,
+           perMediaSecond(results.cpuUs / 1000.0, results),
+           results.sessionUs / 1000000.0);
+    printf("  \"input\": { \"opens\": %u, \"reads\": %u, "
+           "\"failed_opens\": %u, \"failed_reads\": %u, \"bytes\": %llu }\n}\n",
+           results.input.opens, results.input.reads,
+           results.input.failedOpens, results.input.failedReads,
+           (unsigned long long)results.input.bytesRead);
+}
+
+void printUsage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [options] <playlist url>\n"
+        "network:\n"
+        "  --root DIR             directory urls are relative to\n"
+        "  --kbps N               constant throughput (default unlimited)\n"
+        "  --trace FILE           throughput trace, '<seconds> <kbps>' lines\n"
+        "  --rtt MS               latency of each request (default 0)\n"
+        "  --jitter MS            random extra latency, up to (default 0)\n"
+        "  --open-failure RATE    fraction of requests that fail\n"
+        "  --read-failure RATE    fraction of reads that fail\n"
+        "  --seed N               seed for jitter and failures (default 1)\n"
+        "player:\n"
+        "  --startup MS           media buffered before the first frame\n"
+        "                         (default 0)\n"
+        "  --resume MS            media buffered before resuming from a\n"
+        "                         stall (default 1000)\n"
+        "  --max-buffer MS        media buffered ahead (default 30000)\n"
+        "  --max-kbps N           play the highest variant within N kbps\n"
+        "                         (default: the first variant listed)\n"
+        "  --video-mb N           stream video buffer (default 8)\n"
+        "  --audio-mb N           stream audio buffer (default 2)\n"
+        "simulation:\n"
+        "  --tick MS              virtual time per update (default 1)\n"
+        "  --duration SEC         virtual time limit (default 3600)\n"
+        "  --json                 write results as JSON\n", name);
+}
+
+bool parseNumber(const char* arg, double* out)
+{
+    char* end;
+    *out = arg ? strtod(arg, &end) : -1.0;
+    return arg && *arg && !*end && *out >= 0.0;
+}
+
+bool parseScaled(const char* arg, double scale, uint64_t* out)
+{
+    double value;
+    if (!parseNumber(arg, &value) || value * scale > 1e15)
+        return false;
+    *out = (uint64_t)(value * scale + 0.5);
+    return true;
+}
+
+bool parseRate(const char* arg, double* out)
+{
+    return parseNumber(arg, out) && *out <= 1.0;
+}
+
+bool loadTrace(const char* path, NetworkProfile& network)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "%s: cannot open trace\n", path);
+        return false;
+    }
+    std::string text;
+    char chunk[4096];
+    size_t len;
+    while ((len = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        text.append(chunk, len);
+    fclose(fp);
+    if (!network.parseTrace(text.data(), text.size()))
+    {
+        fprintf(stderr, "%s: invalid trace\n", path);
+        return false;
+    }
+    return true;
+}
+
+} /* anonymous namespace */
+
+int main(int argc, const char* argv[])
+{
+    Options options;
+    NetworkProfile& network = options.network;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i+1 < argc ? argv[i+1] : nullptr;
+        bool ok = true;
+        bool usesValue = true;
+        uint64_t scaled = 0;
+        if (!strcmp(arg, "--json"))
+        {
+            options.json = true;
+            usesValue = false;
+        }
+        else if (arg[0] != '-')
+        {
+            usesValue = false;
+            ok = options.url.empty();
+            options.url = arg;
+        }
+        else if (!value)
+            ok = false;
+        else if (!strcmp(arg, "--root"))
+            options.root = value;
+        else if (!strcmp(arg, "--kbps"))
+        {
+            ok = parseScaled(value, 1000.0, &scaled) && scaled;
+            network.trace.assign(1, NetworkProfile::Step { 1000000, scaled });
+            options.traceName.clear();
+        }
+        else if (!strcmp(arg, "--trace"))
+        {
+            ok = loadTrace(value, network);
+            options.traceName = value;
+        }
+        else if (!strcmp(arg, "--rtt"))
+        {
+            ok = parseScaled(value, 1000.0, &scaled) && scaled <= 0xffffffff;
+            network.rttUs = (uint32_t)scaled;
+        }
+        else if (!strcmp(arg, "--jitter"))
+        {
+            ok = parseScaled(value, 1000.0, &scaled) && scaled <= 0xffffffff;
+            network.jitterUs = (uint32_t)scaled;
+        }
+        else if (!strcmp(arg, "--open-failure"))
+            ok = parseRate(value, &network.openFailureRate);
+        else if (!strcmp(arg, "--read-failure"))
+            ok = parseRate(value, &network.readFailureRate);
+        else if (!strcmp(arg, "--seed"))
+            ok = parseScaled(value, 1.0, &network.seed);
+        else if (!strcmp(arg, "--startup"))
+            ok = parseScaled(value, 1000.0, &options.startupUs);
+        else if (!strcmp(arg, "--resume"))
+            ok = parseScaled(value, 1000.0, &options.resumeUs);
+        else if (!strcmp(arg, "--max-buffer"))
+            ok = parseScaled(value, 1000.0, &options.maxBufferUs) &&
+                 options.maxBufferUs;
+        else if (!strcmp(arg, "--max-kbps"))
+        {
+            ok = parseScaled(value, 1000.0, &scaled) && scaled &&
+                 scaled <= 0xffffffff;
+            options.maxBandwidth = (uint32_t)scaled;
+        }
+        else if (!strcmp(arg, "--video-mb"))
+        {
+            ok = parseScaled(value, 1024.0*1024.0, &scaled) && scaled &&
+                 scaled < (1u << 31);
+            options.videoBufferSize = (size_t)scaled;
+        }
+        else if (!strcmp(arg, "--audio-mb"))
+        {
+            ok = parseScaled(value, 1024.0*1024.0, &scaled) && scaled &&
+                 scaled < (1u << 31);
+            options.audioBufferSize = (size_t)scaled;
+        }
+        else if (!strcmp(arg, "--tick"))
+            ok = parseScaled(value, 1000.0, &options.tickUs) && options.tickUs;
+        else if (!strcmp(arg, "--duration"))
+            ok = parseScaled(value, 1000000.0, &options.durationUs);
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            printUsage(argv[0]);
+            return 2;
+        }
+        if (usesValue)
+            ++i;
+    }
+    if (options.url.empty())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    Results results;
+    bool started = simulate(options, results);
+    if (options.json)
+        printJson(options, results);
+    else
+        printText(options, results);
+    return started && results.end == Results::kEnded ? 0 : 1;
+}
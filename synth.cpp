@@ -0,0 +1,520 @@
+/**
+ *  @file       synth.cpp
+ *  @brief      Synthetic MPEG-TS and HLS content for benchmarks and tools
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#include "synth.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace cinekav { namespace synth {
+
+static const int kPacketSize = 188;
+static const uint16_t kPIDNull = 0x1fff;
+
+uint32_t crc32(const uint8_t* data, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc ^= (uint32_t)data[i] << 24;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+    return crc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TSWriter::TSWriter(Bytes* out) :
+    _out(out),
+    _rnd(nullptr),
+    _corruptRate(0.0),
+    _dropRate(0.0),
+    _bytes(0),
+    _packets(0),
+    _nulls(0),
+    _corrupted(0),
+    _dropped(0)
+{
+    memset(_cc, 0, sizeof(_cc));
+}
+
+void TSWriter::setImpairments(Random* rnd, double corruptRate,
+                              double dropRate)
+{
+    _rnd = rnd;
+    _corruptRate = corruptRate;
+    _dropRate = dropRate;
+}
+
+void TSWriter::emit(uint8_t* packet)
+{
+    _bytes += kPacketSize;
+    ++_packets;
+    if (_rnd && _rnd->chance(_dropRate))
+    {
+        ++_dropped;
+        return;
+    }
+    if (_rnd && _rnd->chance(_corruptRate))
+    {
+        //  the header is left intact so the packet still syncs
+        packet[_rnd->range(4, kPacketSize)] ^= (uint8_t)_rnd->range(1, 256);
+        ++_corrupted;
+    }
+    _out->insert(_out->end(), packet, packet + kPacketSize);
+}
+
+void TSWriter::write(uint16_t pid, const uint8_t* data, size_t len,
+                     int64_t pcr, bool randomAccess)
+{
+    bool start = true;
+    while (len || start)
+    {
+        uint8_t packet[kPacketSize];
+        uint8_t* p = packet;
+        bool hasPCR = start && pcr >= 0;
+        size_t room = 184 - (hasPCR ? 8 : 0);
+        size_t cnt = std::min(len, room);
+        size_t stuffing = room - cnt;
+        bool hasAdaptation = hasPCR || stuffing;
+
+        uint8_t& cc = _cc[pid & 0x1fff];
+        *p++ = 0x47;
+        *p++ = (start ? 0x40 : 0x00) | (uint8_t)((pid >> 8) & 0x1f);
+        *p++ = (uint8_t)pid;
+        *p++ = (hasAdaptation ? 0x30 : 0x10) | cc;
+        cc = (cc + 1) & 0x0f;
+
+        if (hasPCR)
+        {
+            uint64_t base = (uint64_t)pcr / 300;
+            uint32_t ext = (uint32_t)((uint64_t)pcr % 300);
+            *p++ = (uint8_t)(7 + stuffing);
+            *p++ = 0x10 | (randomAccess ? 0x40 : 0x00);
+            *p++ = (uint8_t)(base >> 25);
+            *p++ = (uint8_t)(base >> 17);
+            *p++ = (uint8_t)(base >> 9);
+            *p++ = (uint8_t)(base >> 1);
+            *p++ = (uint8_t)(((base & 1) << 7) | 0x7e | ((ext >> 8) & 1));
+            *p++ = (uint8_t)ext;
+            memset(p, 0xff, stuffing);
+            p += stuffing;
+        }
+        else if (stuffing)
+        {
+            //  a single byte of stuffing is an empty adaptation field
+            *p++ = (uint8_t)(stuffing - 1);
+            if (stuffing > 1)
+            {
+                *p++ = 0x00;
+                memset(p, 0xff, stuffing - 2);
+                p += stuffing - 2;
+            }
+        }
+        memcpy(p, data, cnt);
+        emit(packet);
+
+        data += cnt;
+        len -= cnt;
+        start = false;
+    }
+}
+
+void TSWriter::writeSection(uint16_t pid, uint8_t tableId, uint16_t extension,
+                            const Bytes& body)
+{
+    Bytes section;
+    section.push_back(0x00);                        // pointer field
+    section.push_back(tableId);
+    size_t length = 5 + body.size() + 4;
+    section.push_back(0xb0 | (uint8_t)(length >> 8));
+    section.push_back((uint8_t)length);
+    section.push_back((uint8_t)(extension >> 8));
+    section.push_back((uint8_t)extension);
+    section.push_back(0xc1);                        // version 0, current
+    section.push_back(0x00);
+    section.push_back(0x00);
+    section.insert(section.end(), body.begin(), body.end());
+    uint32_t crc = crc32(section.data() + 1, section.size() - 1);
+    for (int shift = 24; shift >= 0; shift -= 8)
+        section.push_back((uint8_t)(crc >> shift));
+    write(pid, section.data(), section.size());
+}
+
+static void pushTimecode(Bytes& out, uint8_t prefix, uint64_t t)
+{
+    out.push_back((uint8_t)((prefix << 4) | (((t >> 30) & 0x07) << 1) | 1));
+    out.push_back((uint8_t)(t >> 22));
+    out.push_back((uint8_t)((((t >> 15) & 0x7f) << 1) | 1));
+    out.push_back((uint8_t)(t >> 7));
+    out.push_back((uint8_t)(((t & 0x7f) << 1) | 1));
+}
+
+void TSWriter::writePES(uint16_t pid, uint8_t streamId, const Bytes& payload,
+                        uint64_t pts, uint64_t dts, int64_t pcr,
+                        bool randomAccess)
+{
+    //  video PES packets are unbounded (length 0)
+    size_t length = payload.size() + (pts == dts ? 8 : 13);
+    if (streamId >= 0xe0 || length > 0xffff)
+        length = 0;
+    Bytes pes = { 0x00, 0x00, 0x01, streamId,
+                  (uint8_t)(length >> 8), (uint8_t)length, 0x80 };
+    if (pts == dts)
+    {
+        pes.push_back(0x80);
+        pes.push_back(5);
+        pushTimecode(pes, 0x2, pts);
+    }
+    else
+    {
+        pes.push_back(0xc0);
+        pes.push_back(10);
+        pushTimecode(pes, 0x3, pts);
+        pushTimecode(pes, 0x1, dts);
+    }
+    pes.insert(pes.end(), payload.begin(), payload.end());
+    write(pid, pes.data(), pes.size(), pcr, randomAccess);
+}
+
+void TSWriter::padTo(uint64_t bytes)
+{
+    uint8_t packet[kPacketSize];
+    packet[0] = 0x47;
+    packet[1] = (uint8_t)(kPIDNull >> 8);
+    packet[2] = (uint8_t)kPIDNull;
+    packet[3] = 0x10;
+    memset(packet + 4, 0xff, kPacketSize - 4);
+    while (_bytes + kPacketSize <= bytes)
+    {
+        _out->insert(_out->end(), packet, packet + kPacketSize);
+        _bytes += kPacketSize;
+        ++_packets;
+        ++_nulls;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void appendRandom(Bytes& out, Random& rnd, size_t size)
+{
+    //  no zero bytes, so no start codes or emulation prevention
+    for (size_t i = 0; i < size; ++i)
+        out.push_back((uint8_t)rnd.range(1, 256));
+}
+
+void appendH264Frame(Bytes& out, Random& rnd, size_t size, bool idr,
+                     int slices)
+{
+    static const uint8_t kAUD[] = { 0, 0, 0, 1, 0x09, 0xf0 };
+    static const uint8_t kSPS[] = { 0, 0, 0, 1, 0x67, 0x4d, 0x40, 0x1f, 0x96,
+                                    0x54, 0x05, 0x01, 0xed, 0x08 };
+    static const uint8_t kPPS[] = { 0, 0, 0, 1, 0x68, 0xee, 0x3c, 0x80 };
+    //  user data unregistered, with a 16 byte uuid
+    static const uint8_t kSEI[] = { 0, 0, 1, 0x06, 0x05, 0x10,
+                                    0xdc, 0x45, 0xe9, 0xbd, 0xe6, 0xd9, 0x48,
+                                    0xb7, 0x96, 0x2c, 0xd8, 0x20, 0xd9, 0x23,
+                                    0xee, 0xef, 0x80 };
+    out.insert(out.end(), kAUD, kAUD + sizeof(kAUD));
+    if (idr)
+    {
+        out.insert(out.end(), kSPS, kSPS + sizeof(kSPS));
+        out.insert(out.end(), kPPS, kPPS + sizeof(kPPS));
+        out.insert(out.end(), kSEI, kSEI + sizeof(kSEI));
+    }
+    if (slices < 1)
+        slices = 1;
+    size_t sliceSize = size / slices + 1;
+    for (int slice = 0; slice < slices; ++slice)
+    {
+        //  first_mb_in_slice is 0 (ue '1') only for the first slice
+        uint8_t header[] = { 0, 0, 1, (uint8_t)(idr ? 0x65 : 0x41),
+                             (uint8_t)(slice ? 0x40 | rnd.range(1, 32) : 0x88) };
+        out.insert(out.end(), header, header + sizeof(header));
+        appendRandom(out, rnd, sliceSize);
+    }
+}
+
+static uint8_t samplingIndex(uint32_t sampleRate)
+{
+    static const uint32_t kRates[] = {
+        96000, 88200, 64000, 48000, 44100, 32000,
+        24000, 22050, 16000, 12000, 11025, 8000, 7350
+    };
+    for (uint8_t i = 0; i < sizeof(kRates)/sizeof(kRates[0]); ++i)
+    {
+        if (kRates[i] == sampleRate)
+            return i;
+    }
+    return 3;
+}
+
+void appendADTSFrame(Bytes& out, Random& rnd, size_t size,
+                     uint32_t sampleRate, uint8_t channels)
+{
+    const uint8_t kProfileLC = 1;           // object type - 1
+    size_t length = 7 + size;
+    uint8_t header[] = {
+        0xff, 0xf1,                         // MPEG-4, no CRC
+        (uint8_t)((kProfileLC << 6) | (samplingIndex(sampleRate) << 2) |
+                  ((channels >> 2) & 1)),
+        (uint8_t)(((channels & 3) << 6) | ((length >> 11) & 3)),
+        (uint8_t)(length >> 3),
+        (uint8_t)(((length & 7) << 5) | 0x1f),
+        0xfc                                // VBR fullness, one raw block
+    };
+    out.insert(out.end(), header, header + sizeof(header));
+    for (size_t i = 0; i < size; ++i)
+        out.push_back((uint8_t)rnd.next());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//  timestamps start at 1.4 seconds, with the PCR 700 ms ahead of the DTS
+static const uint64_t kBaseTicks = 126000;
+static const uint64_t kPCRDelayTicks = 63000;
+static const uint32_t kAudioFrameSamples = 1024;
+
+Generator::Generator(const Config& config) :
+    _config(config),
+    _rnd(config.seed),
+    _impairRnd(config.seed ^ 0x9e3779b97f4a7c15ull),
+    _frame(0),
+    _gopFrame(0),
+    _audioSamples(0),
+    _lastPSIPts(0),
+    _peakBps(0),
+    _videoFrames(0),
+    _idrFrames(0),
+    _audioFrames(0)
+{
+    if (_config.programs < 1)
+        _config.programs = 1;
+    if (_config.gopFrames < 1)
+        _config.gopFrames = 1;
+    if (!_config.fpsNum || !_config.fpsDen)
+    {
+        _config.fpsNum = 30000;
+        _config.fpsDen = 1001;
+    }
+    _writer.setImpairments(&_impairRnd, _config.corruptRate,
+                           _config.dropRate);
+}
+
+uint64_t Generator::frameDts(uint64_t frame) const
+{
+    return kBaseTicks + frame * 90000 * _config.fpsDen / _config.fpsNum;
+}
+
+uint64_t Generator::durationUs(int frameCount) const
+{
+    return (uint64_t)frameCount * 1000000 * _config.fpsDen / _config.fpsNum;
+}
+
+int Generator::framesFor(uint32_t durationMs) const
+{
+    uint64_t frames = ((uint64_t)durationMs * _config.fpsNum +
+                       500 * _config.fpsDen) / (1000 * _config.fpsDen);
+    return frames ? (int)frames : 1;
+}
+
+uint32_t Generator::averageBandwidth() const
+{
+    if (!_frame)
+        return 0;
+    uint64_t durationTicks = frameDts(_frame) - kBaseTicks;
+    return (uint32_t)(_writer.bytesWritten() * 8 * 90000 / durationTicks);
+}
+
+auto Generator::stats() const -> Stats
+{
+    Stats stats;
+    stats.bytes = _writer.bytesWritten();
+    stats.packets = _writer.packetCount();
+    stats.nullPackets = _writer.nullCount();
+    stats.corrupted = _writer.corruptedCount();
+    stats.dropped = _writer.droppedCount();
+    stats.videoFrames = _videoFrames;
+    stats.idrFrames = _idrFrames;
+    stats.audioFrames = _audioFrames;
+    return stats;
+}
+
+void Generator::writePSI()
+{
+    Bytes pat;
+    for (int program = 0; program < _config.programs; ++program)
+    {
+        uint16_t number = (uint16_t)(program + 1);
+        uint16_t pmtPid = _config.pmtPid + program;
+        pat.push_back((uint8_t)(number >> 8));
+        pat.push_back((uint8_t)number);
+        pat.push_back(0xe0 | (uint8_t)(pmtPid >> 8));
+        pat.push_back((uint8_t)pmtPid);
+    }
+    _writer.writeSection(0x0000, 0x00, 1, pat);
+
+    for (int program = 0; program < _config.programs; ++program)
+    {
+        uint16_t offset = (uint16_t)(program * _config.pidStride);
+        uint16_t videoPid = _config.videoPid + offset;
+        uint16_t audioPid = _config.audioPid + offset;
+        Bytes pmt = {
+            (uint8_t)(0xe0 | (videoPid >> 8)), (uint8_t)videoPid,   // PCR
+            0xf0, 0x00,
+            0x1b,                                                   // H.264
+            (uint8_t)(0xe0 | (videoPid >> 8)), (uint8_t)videoPid,
+            0xf0, 0x00
+        };
+        if (_config.audioKbps)
+        {
+            Bytes audio = {
+                0x0f,                                               // AAC
+                (uint8_t)(0xe0 | (audioPid >> 8)), (uint8_t)audioPid,
+                0xf0, 0x00
+            };
+            pmt.insert(pmt.end(), audio.begin(), audio.end());
+        }
+        _writer.writeSection(_config.pmtPid + program, 0x02,
+                             (uint16_t)(program + 1), pmt);
+    }
+}
+
+void Generator::generateSegment(int frameCount, Bytes& out)
+{
+    _writer.setOutput(&out);
+    uint64_t startBytes = _writer.bytesWritten();
+    uint64_t startFrame = _frame;
+
+    //  IDR frames are sized so that a GOP averages the video bitrate
+    uint64_t gop = _config.gopFrames;
+    uint64_t bytesPerFrame = (uint64_t)_config.videoKbps * 125 *
+                             _config.fpsDen / _config.fpsNum;
+    uint64_t frameBytes = bytesPerFrame * gop / (gop + 3);
+    uint64_t idrBytes = frameBytes * 4;
+    uint64_t audioBytes = (uint64_t)_config.audioKbps * 125 *
+                          kAudioFrameSamples / _config.sampleRate;
+    uint32_t psiTicks = _config.psiIntervalMs * 90;
+
+    for (int i = 0; i < frameCount; ++i)
+    {
+        bool idr = !i || _gopFrame % gop == 0;
+        if (idr)
+            _gopFrame = 0;
+        uint64_t dts = frameDts(_frame);
+        uint64_t nextDts = frameDts(_frame + 1);
+
+        if (!i || dts - _lastPSIPts >= psiTicks)
+        {
+            writePSI();
+            _lastPSIPts = dts;
+        }
+        if (_config.muxKbps)
+        {
+            _writer.padTo((uint64_t)_config.muxKbps * 125 *
+                          (dts - kBaseTicks) / 90000);
+        }
+
+        for (int program = 0; program < _config.programs; ++program)
+        {
+            uint64_t size = idr ? idrBytes : frameBytes;
+            size = size * _rnd.range(75, 126) / 100;
+            Bytes video;
+            appendH264Frame(video, _rnd, (size_t)size, idr, _config.slices);
+            //  presented a frame later, as with one frame of reordering
+            int64_t pcr = (int64_t)(dts - kPCRDelayTicks) * 300;
+            _writer.writePES(_config.videoPid + program * _config.pidStride,
+                             0xe0, video, nextDts, dts, pcr, idr);
+        }
+        ++_videoFrames;
+        if (idr)
+            ++_idrFrames;
+
+        while (_config.audioKbps)
+        {
+            uint64_t pts = kBaseTicks +
+                           _audioSamples * 90000 / _config.sampleRate;
+            if (pts >= nextDts)
+                break;
+            for (int program = 0; program < _config.programs; ++program)
+            {
+                Bytes audio;
+                appendADTSFrame(audio, _rnd,
+                                (size_t)(audioBytes * _rnd.range(90, 111) / 100),
+                                _config.sampleRate, _config.channels);
+                _writer.writePES(_config.audioPid +
+                                     program * _config.pidStride,
+                                 0xc0, audio, pts, pts);
+            }
+            _audioSamples += kAudioFrameSamples;
+            ++_audioFrames;
+        }
+
+        ++_frame;
+        ++_gopFrame;
+    }
+
+    uint64_t ticks = frameDts(_frame) - frameDts(startFrame);
+    if (ticks)
+    {
+        uint64_t bps = (_writer.bytesWritten() - startBytes) * 8 * 90000 /
+                       ticks;
+        _peakBps = std::max(_peakBps, (uint32_t)bps);
+    }
+    _writer.setOutput(nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+std::string makeMediaPlaylist(const MediaPlaylistConfig& config)
+{
+    char line[256];
+    std::string text = "#EXTM3U\n#EXT-X-VERSION:3\n";
+    snprintf(line, sizeof(line),
+             "#EXT-X-TARGETDURATION:%u\n#EXT-X-MEDIA-SEQUENCE:%u\n",
+             (unsigned)((config.segmentDurationUs + 500000) / 1000000),
+             config.mediaSequence);
+    text += line;
+    for (int i = 0; i < config.segments; ++i)
+    {
+        int file = config.fileCount > 0 ? i % config.fileCount : i;
+        snprintf(line, sizeof(line), "#EXTINF:%u.%06u,\n",
+                 (unsigned)(config.segmentDurationUs / 1000000),
+                 (unsigned)(config.segmentDurationUs % 1000000));
+        text += line;
+        snprintf(line, sizeof(line), config.uriFormat.c_str(), file);
+        text += line;
+        text += '\n';
+    }
+    if (config.ended)
+        text += "#EXT-X-ENDLIST\n";
+    return text;
+}
+
+std::string makeMasterPlaylist(const std::vector<Variant>& variants)
+{
+    char line[512];
+    std::string text = "#EXTM3U\n#EXT-X-VERSION:3\n";
+    for (auto& variant : variants)
+    {
+        snprintf(line, sizeof(line),
+                 "#EXT-X-STREAM-INF:BANDWIDTH=%u,RESOLUTION=%ux%u,"
+                 "CODECS=\"%s\"\n",
+                 variant.bandwidth, variant.width, variant.height,
+                 variant.codecs.c_str());
+        text += line;
+        text += variant.uri;
+        text += '\n';
+    }
+    return text;
+}
+
+} /* namespace synth */ } /* namespace cinekav */
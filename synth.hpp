@@ -0,0 +1,216 @@
+/**
+ *  @file       synth.hpp
+ *  @brief      Synthetic MPEG-TS and HLS content for benchmarks and tools
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#ifndef CINEK_AVLIB_SYNTH_HPP
+#define CINEK_AVLIB_SYNTH_HPP
+
+#include "avdefs.hpp"
+
+#include <string>
+#include <vector>
+
+namespace cinekav { namespace synth {
+
+using Bytes = std::vector<uint8_t>;
+
+//  xorshift64*.  All content is generated from a seed, so output is
+//  reproducible.
+class Random
+{
+public:
+    Random(uint64_t seed=1) : _state(seed ? seed : 1) {}
+
+    uint32_t next()
+    {
+        _state ^= _state >> 12;
+        _state ^= _state << 25;
+        _state ^= _state >> 27;
+        return (uint32_t)((_state * 2685821657736338717ull) >> 32);
+    }
+    //  [lo, hi)
+    uint32_t range(uint32_t lo, uint32_t hi) { return lo + next() % (hi - lo); }
+    //  true with the given probability
+    bool chance(double probability) {
+        return probability > 0.0 && next() < probability * 4294967296.0;
+    }
+
+private:
+    uint64_t _state;
+};
+
+//  CRC-32/MPEG-2, as used by PSI sections
+uint32_t crc32(const uint8_t* data, size_t len);
+
+//  Packetizes PSI sections and PES packets into 188 byte packets.
+class TSWriter
+{
+public:
+    explicit TSWriter(Bytes* out=nullptr);
+
+    //  continues writing to another output, keeping continuity counters
+    void setOutput(Bytes* out) { _out = out; }
+
+    //  packets are corrupted (a payload byte flipped) or dropped at the
+    //  given rates, using rnd.
+    void setImpairments(Random* rnd, double corruptRate, double dropRate);
+
+    //  writes a payload unit.  pcr is in 27 MHz units, or -1 for none, and
+    //  is carried in the first packet with the random access indicator set
+    //  if randomAccess is true.
+    void write(uint16_t pid, const uint8_t* data, size_t len,
+               int64_t pcr=-1, bool randomAccess=false);
+    void writeSection(uint16_t pid, uint8_t tableId, uint16_t extension,
+                      const Bytes& body);
+    //  pts and dts are in 90 kHz units.  dts is omitted if equal to pts.
+    void writePES(uint16_t pid, uint8_t streamId, const Bytes& payload,
+                  uint64_t pts, uint64_t dts, int64_t pcr=-1,
+                  bool randomAccess=false);
+    //  pads the output with null packets to at least the given size
+    void padTo(uint64_t bytes);
+
+    uint64_t bytesWritten() const { return _bytes; }
+    uint32_t packetCount() const { return _packets; }
+    uint32_t nullCount() const { return _nulls; }
+    uint32_t corruptedCount() const { return _corrupted; }
+    uint32_t droppedCount() const { return _dropped; }
+
+private:
+    void emit(uint8_t* packet);
+
+    Bytes* _out;
+    uint8_t _cc[0x2000];
+    Random* _rnd;
+    double _corruptRate;
+    double _dropRate;
+    uint64_t _bytes;            // including dropped packets
+    uint32_t _packets;
+    uint32_t _nulls;
+    uint32_t _corrupted;
+    uint32_t _dropped;
+};
+
+//  Appends an H.264 access unit: a delimiter, parameter sets and SEI on IDR
+//  frames, then slices of random bytes totalling about size bytes.  Slice
+//  data never contains a start code.
+void appendH264Frame(Bytes& out, Random& rnd, size_t size, bool idr,
+                     int slices=1);
+
+//  Appends an ADTS frame of AAC-LC audio with size bytes of random data.
+void appendADTSFrame(Bytes& out, Random& rnd, size_t size,
+                     uint32_t sampleRate, uint8_t channels);
+
+struct Config
+{
+    uint64_t seed = 1;
+
+    //  each program's PIDs are offset by pidStride from the previous
+    //  program's.
+    int programs = 1;
+    uint16_t pmtPid = 0x1000;
+    uint16_t videoPid = 0x100;
+    uint16_t audioPid = 0x101;
+    uint16_t pidStride = 0x10;
+
+    uint32_t fpsNum = 30000;
+    uint32_t fpsDen = 1001;
+    int gopFrames = 30;                 // IDR cadence
+    int slices = 1;                     // slices per frame
+    uint32_t videoKbps = 2000;
+    uint32_t audioKbps = 128;           // 0 for no audio
+    uint32_t sampleRate = 48000;
+    uint8_t channels = 2;
+
+    uint32_t psiIntervalMs = 100;       // PAT and PMT repetition
+    uint32_t muxKbps = 0;               // pads to a constant rate if set
+    double corruptRate = 0.0;
+    double dropRate = 0.0;
+};
+
+//  Multiplexes video and audio for each program in DTS order.  Timestamps
+//  and continuity counters run across calls, so consecutive segments form
+//  one continuous stream.
+class Generator
+{
+public:
+    Generator(const Config& config);
+
+    //  appends frameCount video frames with their audio.  A segment starts
+    //  with the PAT, PMT and an IDR frame.
+    void generateSegment(int frameCount, Bytes& out);
+
+    //  frames per segment of about durationMs
+    int framesFor(uint32_t durationMs) const;
+    uint64_t durationUs(int frameCount) const;
+    //  bits per second of the largest and of all segments generated,
+    //  including null padding, for EXT-X-STREAM-INF.
+    uint32_t peakBandwidth() const { return _peakBps; }
+    uint32_t averageBandwidth() const;
+
+    struct Stats
+    {
+        uint64_t bytes;
+        uint32_t packets;
+        uint32_t nullPackets;
+        uint32_t corrupted;
+        uint32_t dropped;
+        uint32_t videoFrames;
+        uint32_t idrFrames;
+        uint32_t audioFrames;
+    };
+    Stats stats() const;
+
+private:
+    void writePSI();
+    uint64_t frameDts(uint64_t frame) const;
+
+    Config _config;
+    Random _rnd;
+    Random _impairRnd;          // separate, so rates don't alter content
+    TSWriter _writer;
+    uint64_t _frame;
+    uint64_t _gopFrame;
+    uint64_t _audioSamples;
+    uint64_t _lastPSIPts;
+    uint32_t _peakBps;
+    uint32_t _videoFrames;
+    uint32_t _idrFrames;
+    uint32_t _audioFrames;
+};
+
+//  Playlists
+
+struct MediaPlaylistConfig
+{
+    int segments = 0;
+    uint64_t segmentDurationUs = 6000000;
+    uint32_t mediaSequence = 0;
+    //  printf format for segment uris, given the segment's file index.
+    //  Segment i uses file i % fileCount, so thousands of segments can share
+    //  a few files.
+    std::string uriFormat = "segment%05d.ts";
+    int fileCount = 0;                  // 0 for one file per segment
+    bool ended = true;
+};
+
+std::string makeMediaPlaylist(const MediaPlaylistConfig& config);
+
+struct Variant
+{
+    uint32_t bandwidth;
+    uint32_t width;
+    uint32_t height;
+    std::string codecs;
+    std::string uri;
+};
+
+std::string makeMasterPlaylist(const std::vector<Variant>& variants);
+
+} /* namespace synth */ } /* namespace cinekav */
+
+#endif
@@ -0,0 +1,321 @@
+/**
+ *  @file       tsgen.cpp
+ *  @brief      Generates synthetic MPEG-TS files and HLS presentations
+ *
+ *  @copyright  Copyright 2015 Samir Sinha.  All rights reserved.
+ *  @license    This project is released under the ISC license.  See LICENSE
+ *              for the full text.
+ */
+
+#include "synth.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+using namespace cinekav;
+
+namespace {
+
+struct Options
+{
+    synth::Config config;
+    std::string output;
+    bool hls = false;
+    uint32_t durationMs = 10000;        // single TS
+    int segments = 10;
+    uint32_t segmentMs = 6000;
+    int variants = 1;
+    int files = 0;                      // distinct segment files per variant
+};
+
+bool writeFile(const std::string& path, const void* data, size_t len)
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(data, 1, len, fp) == len;
+    ok = !fclose(fp) && ok;
+    if (!ok)
+        fprintf(stderr, "%s: write failed\n", path.c_str());
+    return ok;
+}
+
+bool writeFile(const std::string& path, const std::string& text)
+{
+    return writeFile(path, text.data(), text.size());
+}
+
+bool makeDirectory(const std::string& path)
+{
+    if (!mkdir(path.c_str(), 0755) || errno == EEXIST)
+        return true;
+    fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+    return false;
+}
+
+void printStats(const char* name, const synth::Generator& generator)
+{
+    synth::Generator::Stats stats = generator.stats();
+    fprintf(stderr, "%s: %llu bytes, %u packets (%u null, %u corrupted, "
+            "%u dropped), %u video frames (%u IDR), %u audio frames, "
+            "%u kbps peak\n",
+            name, (unsigned long long)stats.bytes, stats.packets,
+            stats.nullPackets, stats.corrupted, stats.dropped,
+            stats.videoFrames, stats.idrFrames, stats.audioFrames,
+            generator.peakBandwidth() / 1000);
+}
+
+bool generateTS(const Options& options)
+{
+    synth::Generator generator(options.config);
+    synth::Bytes ts;
+    generator.generateSegment(generator.framesFor(options.durationMs), ts);
+    if (!writeFile(options.output, ts.data(), ts.size()))
+        return false;
+    printStats(options.output.c_str(), generator);
+    return true;
+}
+
+//  Writes master.m3u8 and a directory per variant holding index.m3u8 and
+//  its segments.  Variants form a bitrate ladder up to the configured
+//  bitrate.  Segments beyond the file count reuse earlier files, so
+//  playlists can list thousands of segments without writing them all.
+bool generateHLS(const Options& options)
+{
+    if (!makeDirectory(options.output))
+        return false;
+
+    int files = options.files > 0 ? std::min(options.files, options.segments) :
+                                    options.segments;
+    std::vector<synth::Variant> variants;
+    for (int index = 0; index < options.variants; ++index)
+    {
+        synth::Config config = options.config;
+        config.seed = options.config.seed + index;
+        config.videoKbps = options.config.videoKbps * (index + 1) /
+                           options.variants;
+        if (config.muxKbps)
+            config.muxKbps = options.config.muxKbps * (index + 1) /
+                             options.variants;
+        synth::Generator generator(config);
+        int frames = generator.framesFor(options.segmentMs);
+
+        char name[32];
+        snprintf(name, sizeof(name), "v%d", index);
+        std::string dir = options.output + "/" + name;
+        if (!makeDirectory(dir))
+            return false;
+
+        synth::Bytes ts;
+        for (int file = 0; file < files; ++file)
+        {
+            ts.clear();
+            generator.generateSegment(frames, ts);
+            char segment[32];
+            snprintf(segment, sizeof(segment), "/segment%05d.ts", file);
+            if (!writeFile(dir + segment, ts.data(), ts.size()))
+                return false;
+        }
+
+        synth::MediaPlaylistConfig playlist;
+        playlist.segments = options.segments;
+        playlist.segmentDurationUs = generator.durationUs(frames);
+        playlist.fileCount = files;
+        if (!writeFile(dir + "/index.m3u8", makeMediaPlaylist(playlist)))
+            return false;
+        printStats(dir.c_str(), generator);
+
+        uint32_t height = (1080 * (index + 1) / options.variants) & ~1u;
+        synth::Variant variant;
+        variant.bandwidth = generator.peakBandwidth();
+        variant.width = (height * 16 / 9 + 1) & ~1u;
+        variant.height = height;
+        variant.codecs = config.audioKbps ? "avc1.4d401f,mp4a.40.2" :
+                                            "avc1.4d401f";
+        variant.uri = std::string(name) + "/index.m3u8";
+        variants.push_back(variant);
+    }
+    return writeFile(options.output + "/master.m3u8",
+                     makeMasterPlaylist(variants));
+}
+
+void printUsage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [options] <output.ts>\n"
+        "       %s [options] --hls <directory>\n"
+        "content:\n"
+        "  --seed N               random seed (default 1)\n"
+        "  --programs N           programs in the stream (default 1)\n"
+        "  --pmt-pid PID          first program's PIDs; each program's are\n"
+        "  --video-pid PID        offset by --pid-stride (default 0x1000,\n"
+        "  --audio-pid PID        0x100, 0x101 and 0x10)\n"
+        "  --pid-stride N\n"
+        "  --fps NUM[/DEN]        frame rate (default 30000/1001)\n"
+        "  --gop N                frames between IDR frames (default 30)\n"
+        "  --slices N             slices per frame (default 1)\n"
+        "  --video-kbps N         video bitrate (default 2000)\n"
+        "  --audio-kbps N         ADTS AAC bitrate, 0 for none (default 128)\n"
+        "  --mux-kbps N           pad to a constant rate with null packets\n"
+        "  --psi-interval MS      PAT/PMT repetition (default 100)\n"
+        "  --corrupt RATE         fraction of packets with a corrupt byte\n"
+        "  --drop RATE            fraction of packets dropped\n"
+        "output:\n"
+        "  --duration SEC         length of a single TS (default 10)\n"
+        "  --hls                  write an HLS presentation to a directory\n"
+        "  --segments N           segments per media playlist (default 10)\n"
+        "  --segment-duration SEC target segment length (default 6)\n"
+        "  --variants N           bitrate ladder variants (default 1)\n"
+        "  --files N              distinct segment files per variant; more\n"
+        "                         segments reuse them (default: all)\n",
+        name, name);
+}
+
+bool parseNumber(const char* arg, double* out)
+{
+    char* end;
+    *out = strtod(arg, &end);
+    return *arg && !*end && *out >= 0.0;
+}
+
+bool parseRate(const char* arg, double* out)
+{
+    return parseNumber(arg, out) && *out <= 1.0;
+}
+
+template<typename T>
+bool parseUInt(const char* arg, T* out, uint32_t min=0,
+               uint32_t max=0x7fffffff)
+{
+    char* end;
+    unsigned long value = strtoul(arg, &end, 0);
+    if (!*arg || *end || value < min || value > max)
+        return false;
+    *out = (T)value;
+    return true;
+}
+
+bool parseMs(const char* arg, uint32_t* out)
+{
+    double seconds;
+    if (!parseNumber(arg, &seconds) || seconds * 1000.0 > 0xffffffff)
+        return false;
+    *out = (uint32_t)(seconds * 1000.0 + 0.5);
+    return *out > 0;
+}
+
+bool parseFps(const char* arg, uint32_t* num, uint32_t* den)
+{
+    const char* slash = strchr(arg, '/');
+    if (!slash)
+    {
+        *den = 1;
+        return parseUInt(arg, num) && *num;
+    }
+    std::string first(arg, slash);
+    return parseUInt(first.c_str(), num) && parseUInt(slash + 1, den) &&
+           *num && *den;
+}
+
+} /* anonymous namespace */
+
+int main(int argc, const char* argv[])
+{
+    Options options;
+    synth::Config& config = options.config;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char* value = i+1 < argc ? argv[i+1] : nullptr;
+        bool ok = true;
+        bool usesValue = true;
+        if (arg.compare(0, 2, "--") || arg == "--hls")
+        {
+            usesValue = false;
+            if (arg == "--hls")
+                options.hls = true;
+            else if (options.output.empty())
+                options.output = arg;
+            else
+                ok = false;
+        }
+        else if (!value)
+            ok = false;
+        else if (arg == "--seed")
+            ok = parseUInt(value, &config.seed);
+        else if (arg == "--programs")
+            ok = parseUInt(value, &config.programs, 1, 64);
+        else if (arg == "--pmt-pid")
+            ok = parseUInt(value, &config.pmtPid, 0x10, 0x1ffe);
+        else if (arg == "--video-pid")
+            ok = parseUInt(value, &config.videoPid, 0x10, 0x1ffe);
+        else if (arg == "--audio-pid")
+            ok = parseUInt(value, &config.audioPid, 0x10, 0x1ffe);
+        else if (arg == "--pid-stride")
+            ok = parseUInt(value, &config.pidStride, 0, 0x400);
+        else if (arg == "--fps")
+            ok = parseFps(value, &config.fpsNum, &config.fpsDen);
+        else if (arg == "--gop")
+            ok = parseUInt(value, &config.gopFrames, 1);
+        else if (arg == "--slices")
+            ok = parseUInt(value, &config.slices, 1, 256);
+        else if (arg == "--video-kbps")
+            ok = parseUInt(value, &config.videoKbps, 1);
+        else if (arg == "--audio-kbps")
+            ok = parseUInt(value, &config.audioKbps);
+        else if (arg == "--mux-kbps")
+            ok = parseUInt(value, &config.muxKbps);
+        else if (arg == "--psi-interval")
+            ok = parseUInt(value, &config.psiIntervalMs);
+        else if (arg == "--corrupt")
+            ok = parseRate(value, &config.corruptRate);
+        else if (arg == "--drop")
+            ok = parseRate(value, &config.dropRate);
+        else if (arg == "--duration")
+            ok = parseMs(value, &options.durationMs);
+        else if (arg == "--segments")
+            ok = parseUInt(value, &options.segments, 1, 1000000);
+        else if (arg == "--segment-duration")
+            ok = parseMs(value, &options.segmentMs);
+        else if (arg == "--variants")
+            ok = parseUInt(value, &options.variants, 1, 32);
+        else if (arg == "--files")
+            ok = parseUInt(value, &options.files, 0, 1000000);
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            printUsage(argv[0]);
+            return 2;
+        }
+        if (usesValue)
+            ++i;
+    }
+    if (options.output.empty())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+    if (config.programs * config.pidStride + config.videoPid > 0x1fff ||
+        config.programs * config.pidStride + config.audioPid > 0x1fff ||
+        config.programs + config.pmtPid > 0x1fff)
+    {
+        fprintf(stderr, "PIDs exceed 0x1ffe for %d programs\n",
+                config.programs);
+        return 2;
+    }
+
+    bool ok = options.hls ? generateHLS(options) : generateTS(options);
+    return ok ? 0 : 1;
+}